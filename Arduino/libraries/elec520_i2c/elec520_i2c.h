@@ -0,0 +1,62 @@
+#ifndef ELEC520_I2C_H
+#define ELEC520_I2C_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// ---------- Binary I2C frame (Nano -> ESP32) ----------
+// Header only so the Nano and the ESP32 poller share one definition without
+// either pulling in the other's library.
+//
+// One fixed-size frame per requestFrom(addr, I2C_FRAME_LEN):
+//   [len][seq][f][r][type][id][value lo][value hi][crc8]
+// len = I2C_FRAME_LEN, seq counts frames built by the Nano, crc8 (poly 0x07,
+// init 0) covers every byte before it. I2C_T_NONE = nothing to report.
+#define I2C_FRAME_LEN 9
+
+enum I2cSensorType : uint8_t { I2C_T_NONE = 0, I2C_T_CONN = 1, I2C_T_ULTRA = 2, I2C_T_HALL = 3 };
+
+struct I2cReading {
+  uint8_t  seq;
+  uint8_t  f, r;
+  uint8_t  type;   // I2cSensorType
+  uint8_t  id;     // sensor ID within the room (0 for I2C_T_CONN)
+  uint16_t value;  // cm, open01 or connected01
+};
+
+inline uint8_t i2cCrc8(const uint8_t* data, size_t len) {
+  uint8_t crc = 0;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= data[i];
+    for (uint8_t b = 0; b < 8; b++) crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+  }
+  return crc;
+}
+
+// Writes I2C_FRAME_LEN bytes.
+inline void i2cBuildFrame(const I2cReading& rd, uint8_t* out) {
+  out[0] = I2C_FRAME_LEN;
+  out[1] = rd.seq;
+  out[2] = rd.f;
+  out[3] = rd.r;
+  out[4] = rd.type;
+  out[5] = rd.id;
+  out[6] = (uint8_t)rd.value;
+  out[7] = (uint8_t)(rd.value >> 8);
+  out[8] = i2cCrc8(out, I2C_FRAME_LEN - 1);
+}
+
+// False on bad length or CRC.
+inline bool i2cParseFrame(const uint8_t* in, size_t len, I2cReading& rd) {
+  if (!in || len < I2C_FRAME_LEN || in[0] != I2C_FRAME_LEN) return false;
+  if (i2cCrc8(in, I2C_FRAME_LEN - 1) != in[I2C_FRAME_LEN - 1]) return false;
+  rd.seq   = in[1];
+  rd.f     = in[2];
+  rd.r     = in[3];
+  rd.type  = in[4];
+  rd.id    = in[5];
+  rd.value = (uint16_t)(in[6] | (in[7] << 8));
+  return true;
+}
+
+#endif // ELEC520_I2C_H
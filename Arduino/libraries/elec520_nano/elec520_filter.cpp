@@ -0,0 +1,74 @@
+#include "elec520_filter.h"
+
+void filterInit(DistFilter& f, uint8_t medianN, uint8_t emaShift, uint8_t deadbandCm) {
+  memset(&f, 0, sizeof(f));
+  f.medianN = constrain(medianN, 1, FILTER_MEDIAN_MAX);
+  f.emaShift = min(emaShift, (uint8_t)7);
+  f.deadbandCm = deadbandCm;
+  f.median = f.out = FILTER_NO_VALUE;
+}
+
+// Median of the filled part of the window; insertion sort on a copy (N <= 7).
+static uint8_t medianOf(const DistFilter& f) {
+  uint8_t s[FILTER_MEDIAN_MAX];
+  for (uint8_t i = 0; i < f.fill; i++) {
+    uint8_t v = f.window[i], j = i;
+    for (; j > 0 && s[j - 1] > v; j--) s[j] = s[j - 1];
+    s[j] = v;
+  }
+  return s[f.fill / 2];
+}
+
+bool filterPush(DistFilter& f, uint8_t cm) {
+  // The window may have shrunk since the last push (retuned)
+  if (f.fill > f.medianN) f.fill = f.medianN;
+  if (f.pos >= f.medianN) f.pos = 0;
+  f.window[f.pos] = cm;
+  f.pos = (uint8_t)((f.pos + 1) % f.medianN);
+  if (f.fill < f.medianN) f.fill++;
+  f.samples++;
+
+  uint8_t prev = f.median;
+  f.median = medianOf(f);
+
+  uint8_t next;
+  if (f.median == FILTER_NO_VALUE) {
+    next = FILTER_NO_VALUE;
+  } else if (prev == FILTER_NO_VALUE) {
+    f.ema = (uint16_t)f.median << 8;             // restart from the first good reading
+    next = f.median;
+  } else {
+    int16_t step = (int16_t)(((int32_t)((uint16_t)f.median << 8) - (int32_t)f.ema) >> f.emaShift);
+    f.ema = (uint16_t)(f.ema + step);
+    uint8_t e = filterEmaCm(f);
+    int16_t away = (int16_t)e - (int16_t)f.out;
+    if (f.out != FILTER_NO_VALUE && away <= f.deadbandCm && away >= -(int16_t)f.deadbandCm) {
+      if (away) f.held++;
+      return false;
+    }
+    next = e;
+  }
+
+  if (next == f.out) return false;
+  f.out = next;
+  f.changes++;
+  return true;
+}
+
+uint8_t filterOut(const DistFilter& f)   { return f.out; }
+uint8_t filterEmaCm(const DistFilter& f) { return (uint8_t)((f.ema + 128) >> 8); }
+
+void filterPrint(const DistFilter& f, Print& out) {
+  out.print(F("N="));      out.print(f.medianN);
+  out.print(F(" k="));     out.print(f.emaShift);
+  out.print(F(" db="));    out.print(f.deadbandCm);
+  out.print(F(" | win"));
+  for (uint8_t i = 0; i < f.fill; i++) { out.print(' '); out.print(f.window[i]); }
+  out.print(F(" | med="));  out.print(f.median);
+  out.print(F(" ema="));    out.print(f.ema >> 8); out.print('.');
+  out.print((uint8_t)((f.ema & 0xFF) * 10 >> 8));         // one decimal of the 8-bit fraction
+  out.print(F(" out="));    out.print(f.out);
+  out.print(F(" | samples=")); out.print(f.samples);
+  out.print(F(" changes="));   out.print(f.changes);
+  out.print(F(" held="));      out.println(f.held);
+}
@@ -0,0 +1,40 @@
+#ifndef ELEC520_FILTER_H
+#define ELEC520_FILTER_H
+
+#include <Arduino.h>
+
+// ---------- Distance filter (Nano, integer only) ----------
+// raw cm -> median of the last N (drops single bad echoes)
+//        -> EMA, 1/2^shift weight per sample, 8.8 fixed point (smooths jitter)
+//        -> deadband: the output only moves when the EMA is more than
+//           deadbandCm away from it, then snaps to the new value (hysteresis)
+// 255 (no echo) bypasses the EMA: the output follows the median to and from
+// 255 straight away, and the EMA restarts from the first good reading.
+// ~20 bytes of SRAM per sensor.
+#define FILTER_MEDIAN_MAX  7       // longest median window
+#define FILTER_NO_VALUE    255     // same as ULTRA_NO_ECHO
+
+struct DistFilter {
+  // tuning, set by filterInit(), may be changed at any time
+  uint8_t  medianN;                 // 1 (off) .. FILTER_MEDIAN_MAX, odd is best
+  uint8_t  emaShift;                // 0 (off) .. 7
+  uint8_t  deadbandCm;              // 0 = report every whole-cm change
+  // state
+  uint8_t  window[FILTER_MEDIAN_MAX];
+  uint8_t  pos, fill;               // ring position, samples held (<= medianN)
+  uint8_t  median;                  // last median
+  uint16_t ema;                     // cm << 8, valid while median != FILTER_NO_VALUE
+  uint8_t  out;                     // reported value
+  // counters
+  uint16_t samples;                 // readings pushed...
+  uint16_t changes;                 // ...that moved the output...
+  uint16_t held;                    // ...and that moved the EMA but stayed in the deadband
+};
+
+void    filterInit (DistFilter& f, uint8_t medianN, uint8_t emaShift, uint8_t deadbandCm);
+bool    filterPush (DistFilter& f, uint8_t cm);                 // true when the output changed
+uint8_t filterOut  (const DistFilter& f);
+uint8_t filterEmaCm(const DistFilter& f);                       // EMA rounded to cm
+void    filterPrint(const DistFilter& f, Print& out);           // one line of state for tuning
+
+#endif // ELEC520_FILTER_H
@@ -0,0 +1,117 @@
+#if defined(__AVR__)
+
+#include "elec520_ultrasonic.h"
+
+struct UltraSensor {
+  uint8_t  trig, echo;
+  volatile uint8_t* echoIn;   // PINx register and bit, read directly in the ISR
+  uint8_t  echoMask;
+  volatile uint8_t* pcmsk;    // pin-change mask register and bit for the echo pin
+  uint8_t  pcmskBit;
+  uint8_t  pcie;              // PCICR bit for that bank
+  uint8_t  cm;
+  uint16_t echoUs;
+  bool     fresh;
+};
+
+enum : uint8_t { ULTRA_IDLE, ULTRA_WAIT_RISE, ULTRA_WAIT_FALL, ULTRA_DONE };
+
+static UltraSensor sensors[ULTRA_MAX_SENSORS];
+static uint8_t sensorCount = 0;
+static uint8_t active = 0;                 // sensor being pinged
+static volatile uint8_t state = ULTRA_IDLE;
+static volatile uint32_t riseUs = 0;
+static volatile uint32_t widthUs = 0;
+static uint32_t pingUs = 0;                // micros() at the trigger pulse
+static uint32_t settleMs = 0;              // millis() the last ping finished
+
+int8_t ultraAdd(uint8_t trigPin, uint8_t echoPin) {
+  if (sensorCount >= ULTRA_MAX_SENSORS || digitalPinToPCICR(echoPin) == 0) return -1;
+  UltraSensor& s = sensors[sensorCount];
+  s.trig = trigPin;
+  s.echo = echoPin;
+  s.echoIn = portInputRegister(digitalPinToPort(echoPin));
+  s.echoMask = digitalPinToBitMask(echoPin);
+  s.pcmsk = digitalPinToPCMSK(echoPin);
+  s.pcmskBit = digitalPinToPCMSKbit(echoPin);
+  s.pcie = digitalPinToPCICRbit(echoPin);
+  s.cm = ULTRA_NO_ECHO;
+  s.echoUs = 0;
+  s.fresh = false;
+
+  pinMode(trigPin, OUTPUT);
+  digitalWrite(trigPin, LOW);
+  pinMode(echoPin, INPUT);
+  *digitalPinToPCICR(echoPin) |= _BV(s.pcie);   // bank on; the pin itself only while pinged
+  return (int8_t)sensorCount++;
+}
+
+// Shared by the three pin-change vectors; only the pinged echo pin is unmasked,
+// so an edge on some other pin of the bank is ignored by the state check.
+void ultraOnPinChange() {
+  if (sensorCount == 0) return;
+  const UltraSensor& s = sensors[active];
+  bool high = (*s.echoIn & s.echoMask) != 0;
+  if (high && state == ULTRA_WAIT_RISE) {
+    riseUs = micros();
+    state = ULTRA_WAIT_FALL;
+  } else if (!high && state == ULTRA_WAIT_FALL) {
+    widthUs = micros() - riseUs;
+    state = ULTRA_DONE;
+  }
+}
+#ifndef ELEC520_NO_PCINT_ISR
+ISR(PCINT0_vect) { ultraOnPinChange(); }
+ISR(PCINT1_vect) { ultraOnPinChange(); }
+ISR(PCINT2_vect) { ultraOnPinChange(); }
+#endif
+
+static void finish(uint32_t us) {
+  UltraSensor& s = sensors[active];
+  *s.pcmsk &= (uint8_t)~_BV(s.pcmskBit);
+  s.echoUs = (uint16_t)us;
+  uint32_t cm = us / 58UL;                       // round trip at ~343 m/s
+  s.cm = (us == 0 || cm >= ULTRA_NO_ECHO) ? ULTRA_NO_ECHO : (uint8_t)cm;
+  s.fresh = true;
+  state = ULTRA_IDLE;
+  settleMs = millis();
+  active = (uint8_t)((active + 1) % sensorCount);
+}
+
+void ultraService() {
+  if (sensorCount == 0) return;
+
+  uint8_t st = state;
+  if (st == ULTRA_DONE) {
+    noInterrupts();
+    uint32_t us = widthUs;
+    interrupts();
+    finish(us);
+    return;
+  }
+  if (st != ULTRA_IDLE) {
+    if (micros() - pingUs > ULTRA_TIMEOUT_US) finish(0);   // no echo (or it never ended)
+    return;
+  }
+  if (millis() - settleMs < ULTRA_SETTLE_MS) return;
+
+  UltraSensor& s = sensors[active];
+  state = ULTRA_WAIT_RISE;
+  PCIFR = _BV(s.pcie);                           // drop any edge seen while masked
+  *s.pcmsk |= _BV(s.pcmskBit);
+  digitalWrite(s.trig, HIGH);
+  delayMicroseconds(10);                         // the only wait: the 10 us trigger pulse
+  digitalWrite(s.trig, LOW);
+  pingUs = micros();
+}
+
+uint8_t  ultraCount()             { return sensorCount; }
+uint8_t  ultraCm(uint8_t idx)     { return idx < sensorCount ? sensors[idx].cm : ULTRA_NO_ECHO; }
+uint16_t ultraEchoUs(uint8_t idx) { return idx < sensorCount ? sensors[idx].echoUs : 0; }
+bool ultraFresh(uint8_t idx) {
+  if (idx >= sensorCount || !sensors[idx].fresh) return false;
+  sensors[idx].fresh = false;
+  return true;
+}
+
+#endif // __AVR__
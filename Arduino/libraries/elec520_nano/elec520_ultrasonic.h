@@ -0,0 +1,30 @@
+#ifndef ELEC520_ULTRASONIC_H
+#define ELEC520_ULTRASONIC_H
+
+#include <Arduino.h>
+
+// ---------- Non-blocking HC-SR04 capture (Nano) ----------
+// Replaces pulseIn(): ultraService() fires the trigger and returns; the echo
+// edges are timed by the pin-change interrupt, and the next call picks up the
+// result. Sensors are pinged one at a time, round-robin, so they don't hear
+// each other's echoes. Any Nano pin works as echo (PCINT0..2). AVR only.
+//
+// Interrupts: the library defines ISR(PCINT0_vect), ISR(PCINT1_vect) and
+// ISR(PCINT2_vect), so it can't be linked with anything else that defines
+// them (SoftwareSerial, other pin-change libraries). In that case build with
+// ELEC520_NO_PCINT_ISR defined and call ultraOnPinChange() from your own
+// vectors, for every bank that has an echo pin.
+#define ULTRA_MAX_SENSORS 4
+#define ULTRA_TIMEOUT_US  30000UL  // no echo after this = nothing in range (~5 m)
+#define ULTRA_SETTLE_MS   10       // quiet time between pings, lets stray echoes die out
+#define ULTRA_NO_ECHO     255      // ultraCm() value when nothing came back
+
+int8_t   ultraAdd    (uint8_t trigPin, uint8_t echoPin); // index, or -1 when full
+void     ultraService();                                 // call every loop(); never waits on an echo
+uint8_t  ultraCount  ();
+uint8_t  ultraCm     (uint8_t idx);                      // latest distance, 0..254 cm or ULTRA_NO_ECHO
+uint16_t ultraEchoUs (uint8_t idx);                      // latest echo width, 0 = no echo
+bool     ultraFresh  (uint8_t idx);                      // new reading since the last call (clears)
+void     ultraOnPinChange();                             // ISR body, only needed with ELEC520_NO_PCINT_ISR
+
+#endif // ELEC520_ULTRASONIC_H
@@ -1,171 +1,524 @@
 #include "elec520_protocol.h"
+#include <new>
 
 // ---------------- Internals ----------------
 static inline bool inRange(uint8_t v, uint8_t maxv){ return v < maxv; }
 
-static int splitTopic(const String& t, String out[], int maxParts=12) {
-  int n=0, start=0, i;
-  while ((i=t.indexOf('/', start))>=0 && n<maxParts) { out[n++]=t.substring(start,i); start=i+1; }
-  if (start <= (int)t.length() && n<maxParts) out[n++]=t.substring(start);
-  return n;
-}
+static inline bool isWs(char c){ return c==' ' || c=='\t' || c=='\r' || c=='\n'; }
 
-static bool parseBool01(const char* s, bool& out){
+// Unsigned decimal in s[0..n), surrounding whitespace allowed, no heap.
+static bool parseUnsignedN(const char* s, size_t n, uint32_t maxv, uint32_t& out){
   if (!s) return false;
-  if (strcmp(s,"1")==0){ out=true;  return true; }
-  if (strcmp(s,"0")==0){ out=false; return true; }
-  return false;
+  while (n && isWs(*s))      { s++; n--; }
+  while (n && isWs(s[n-1]))  { n--; }
+  if (n == 0) return false;
+  uint32_t v = 0;
+  for (size_t i = 0; i < n; i++){
+    if (s[i] < '0' || s[i] > '9') return false;
+    uint32_t d = (uint32_t)(s[i] - '0');
+    if (v > (maxv - d) / 10) return false;   // would exceed maxv
+    v = v*10 + d;
+  }
+  out = v;
+  return true;
 }
-static bool parseByte(const char* s, uint8_t& out){
-  if (!s || !*s) return false;
-  long v=strtol(s,nullptr,10);
-  if (v<0 || v>255) return false;
-  out=(uint8_t)v;
+
+static bool parseBool01(const char* s, size_t n, bool& out){
+  uint32_t v;
+  if (!parseUnsignedN(s, n, 1, v)) return false;
+  out = (v != 0);
   return true;
 }
-static bool parseUint32(const char* s, uint32_t& out){
-  if (!s || !*s) return false;
-  unsigned long v=strtoul(s,nullptr,10);
-  out = (uint32_t)v;
+static bool parseByte(const char* s, size_t n, uint8_t& out){
+  uint32_t v;
+  if (!parseUnsignedN(s, n, 255, v)) return false;
+  out = (uint8_t)v;
   return true;
 }
+static bool parseUint32(const char* s, size_t n, uint32_t& out){
+  return parseUnsignedN(s, n, 0xFFFFFFFFUL, out);
+}
+
+// One '/'-separated topic segment, referenced in place.
+struct TopicSeg { const char* p; size_t n; };
+
+static inline bool segIs(const TopicSeg& s, const char* lit){
+  size_t l = strlen(lit);
+  return s.n == l && memcmp(s.p, lit, l) == 0;
+}
+static inline bool segId(const TopicSeg& s, uint8_t& out){
+  uint32_t v;
+  if (s.n == 0 || s.n > 3 || isWs(s.p[0])) return false;
+  if (!parseUnsignedN(s.p, s.n, 255, v)) return false;
+  out = (uint8_t)v;
+  return true;
+}
+
+// ---------------- Bit helpers ----------------
+// Masks are 8, 16 or 32 bits wide depending on the limits; loops widen them
+// to uint32_t so one set of helpers serves every width.
+static inline uint32_t bitOf(uint8_t i)       { return (uint32_t)1 << i; }
+static inline uint8_t  lowestBit(uint32_t m)  { return (uint8_t)__builtin_ctzl(m); }
+static inline uint32_t dropLowest(uint32_t m) { return m & (m - 1); }
+static inline uint8_t  popCount(uint32_t m)   { return (uint8_t)__builtin_popcountl(m); }
+
+// OR of a per-sink mask array over the sinks selected in 'sink'.
+template <typename M>
+static inline uint32_t forSinks(const M (&d)[SMP_NUM_SINKS], uint8_t sink){
+  uint32_t m = 0;
+  for (uint8_t i = 0; i < SMP_NUM_SINKS; i++) if (sink & bitOf(i)) m |= d[i];
+  return m;
+}
+template <typename M>
+static inline void markAll(M (&d)[SMP_NUM_SINKS], uint32_t bits){
+  for (uint8_t i = 0; i < SMP_NUM_SINKS; i++) d[i] |= (M)bits;
+}
 
 // ---------------- Global ----------------
 ProtocolModel MODEL;
 
+// Rooms are only reached through MODEL.room(); see DenseModel / SparseModel.
+static inline RoomNode& roomOf(uint8_t f, uint8_t r){ return *MODEL.room(f, r); }
+
+// ---------------- Change tracking ----------------
+static inline void markFloor(uint8_t f, uint8_t bits){
+  markAll(MODEL.floors[f].dirty, bits);
+}
+static inline void markRoom(uint8_t f, uint8_t r, uint8_t bits){
+  markAll(roomOf(f, r).dirty, bits);
+  markAll(MODEL.floors[f].dirtyRooms, bitOf(r));
+}
+static inline void markHall(uint8_t f, uint8_t r, uint8_t h){
+  markAll(roomOf(f, r).dirtyHall, bitOf(h));
+  markAll(MODEL.floors[f].dirtyRooms, bitOf(r));
+}
+static inline void markUltra(uint8_t f, uint8_t r, uint8_t u){
+  markAll(roomOf(f, r).dirtyUltra, bitOf(u));
+  markAll(MODEL.floors[f].dirtyRooms, bitOf(r));
+}
+
 // ---------------- Adders ----------------
+// A newly used entry is dirty so its first value gets sent.
 bool addFloor(uint8_t f_id){
   if (!inRange(f_id, SMP_MAX_FLOORS)) return false;
-  MODEL.floors[f_id].used = true;
+  if (!(MODEL.floorUsed & bitOf(f_id))){ MODEL.floorUsed |= bitOf(f_id); markFloor(f_id, DIRTY_CS); }
   return true;
 }
 bool addRoom(uint8_t f_id, uint8_t r_id){
   if (!addFloor(f_id)) return false;
   if (!inRange(r_id, SMP_MAX_ROOMS)) return false;
-  MODEL.floors[f_id].rooms[r_id].used = true;
+  FloorNode& F = MODEL.floors[f_id];
+  if (!(F.roomUsed & bitOf(r_id))){
+    if (!MODEL.allocRoom(f_id, r_id)) return false;   // sparse model full
+    F.roomUsed |= bitOf(r_id);
+    markRoom(f_id, r_id, DIRTY_CS);
+  }
   return true;
 }
 bool addUltra(uint8_t f_id, uint8_t r_id, uint8_t u_id){
   if (!addRoom(f_id, r_id)) return false;
   if (!inRange(u_id, SMP_MAX_SENSORS)) return false;
-  MODEL.floors[f_id].rooms[r_id].ultra[u_id].used = true;
+  RoomNode& R = roomOf(f_id, r_id);
+  if (!(R.ultraUsed & bitOf(u_id))){ R.ultraUsed |= bitOf(u_id); markUltra(f_id, r_id, u_id); }
   return true;
 }
 bool addHall(uint8_t f_id, uint8_t r_id, uint8_t hs_id){
   if (!addRoom(f_id, r_id)) return false;
   if (!inRange(hs_id, SMP_MAX_SENSORS)) return false;
-  MODEL.floors[f_id].rooms[r_id].hall[hs_id].used = true;
+  RoomNode& R = roomOf(f_id, r_id);
+  if (!(R.hallUsed & bitOf(hs_id))){ R.hallUsed |= bitOf(hs_id); markHall(f_id, r_id, hs_id); }
+  return true;
+}
+
+// ---------------- Tracked setters ----------------
+bool setFloorConnected(uint8_t f_id, bool connected){
+  if (!addFloor(f_id)) return false;
+  FloorNode& F = MODEL.floors[f_id];
+  if (F.connected != (uint8_t)connected){ F.connected = connected; markFloor(f_id, DIRTY_CS); }
   return true;
 }
+bool setFloorTimestamp(uint8_t f_id, uint32_t ts){
+  if (!addFloor(f_id)) return false;
+  FloorNode& F = MODEL.floors[f_id];
+  if (F.ts != ts){ F.ts = ts; markFloor(f_id, DIRTY_TS); }
+  return true;
+}
+bool setRoomConnected(uint8_t f_id, uint8_t r_id, bool connected){
+  if (!addRoom(f_id, r_id)) return false;
+  RoomNode& R = roomOf(f_id, r_id);
+  if (R.connected != (uint8_t)connected){ R.connected = connected; markRoom(f_id, r_id, DIRTY_CS); }
+  return true;
+}
+bool setRoomTimestamp(uint8_t f_id, uint8_t r_id, uint32_t ts){
+  if (!addRoom(f_id, r_id)) return false;
+  RoomNode& R = roomOf(f_id, r_id);
+  if (R.ts != ts){ R.ts = ts; markRoom(f_id, r_id, DIRTY_TS); }
+  return true;
+}
+bool setUltraValue(uint8_t f_id, uint8_t r_id, uint8_t u_id, uint8_t value){
+  if (!addUltra(f_id, r_id, u_id)) return false;
+  RoomNode& R = roomOf(f_id, r_id);
+  if (R.ultra[u_id] != value){ R.ultra[u_id] = value; markUltra(f_id, r_id, u_id); }
+  return true;
+}
+// ---------------- Alarm events ----------------
+static AlarmEvent alarmQ[SMP_ALARM_QUEUE_LEN];
+static uint8_t  alarmHead = 0, alarmCount = 0;
+static uint32_t alarmDropped = 0;
+
+static void flagAlarm(uint8_t f, uint8_t r, uint8_t h){
+  if (alarmCount == SMP_ALARM_QUEUE_LEN){ alarmDropped++; return; }
+  AlarmEvent& ev = alarmQ[(alarmHead + alarmCount) % SMP_ALARM_QUEUE_LEN];
+  ev.f = f; ev.r = r; ev.h = h; ev.atUs = micros();
+  alarmCount++;
+}
+
+bool takeAlarmEvent(AlarmEvent& ev){
+  if (!alarmCount) return false;
+  ev = alarmQ[alarmHead];
+  alarmHead = (alarmHead + 1) % SMP_ALARM_QUEUE_LEN;
+  alarmCount--;
+  return true;
+}
+uint8_t  pendingAlarmEvents(){ return alarmCount; }
+uint32_t droppedAlarmEvents(){ return alarmDropped; }
+
+bool setHallOpen(uint8_t f_id, uint8_t r_id, uint8_t hs_id, bool open){
+  if (!addHall(f_id, r_id, hs_id)) return false;
+  RoomNode& R = roomOf(f_id, r_id);
+  bool was = (R.hallOpen & bitOf(hs_id)) != 0;
+  if (was != open){
+    R.hallOpen ^= bitOf(hs_id);
+    markHall(f_id, r_id, hs_id);
+    if (open && MODEL.systemState == ARMED) flagAlarm(f_id, r_id, hs_id);
+  }
+  return true;
+}
+
+bool isFloorDirty(uint8_t f_id, uint8_t sink){
+  if (!inRange(f_id, SMP_MAX_FLOORS)) return false;
+  const FloorNode& F = MODEL.floors[f_id];
+  return (forSinks(F.dirty, sink) | forSinks(F.dirtyRooms, sink)) != 0;
+}
+bool isRoomDirty(uint8_t f_id, uint8_t r_id, uint8_t sink){
+  if (!inRange(f_id, SMP_MAX_FLOORS) || !inRange(r_id, SMP_MAX_ROOMS)) return false;
+  return (forSinks(MODEL.floors[f_id].dirtyRooms, sink) & bitOf(r_id)) != 0;
+}
+
+// What the room string and frame carry: cs and the sensors, not ts.
+bool isRoomDataDirty(uint8_t f_id, uint8_t r_id, uint8_t sink){
+  if (!isRoomDirty(f_id, r_id, sink)) return false;
+  const RoomNode& R = roomOf(f_id, r_id);
+  return (forSinks(R.dirty, sink) & DIRTY_CS)
+      || (R.ultraUsed & forSinks(R.dirtyUltra, sink))
+      || (R.hallUsed  & forSinks(R.dirtyHall,  sink));
+}
+
+void clearRoomDirty(uint8_t f_id, uint8_t r_id, uint8_t sink){
+  if (!inRange(f_id, SMP_MAX_FLOORS) || !inRange(r_id, SMP_MAX_ROOMS)) return;
+  FloorNode& F = MODEL.floors[f_id];
+  if (!(F.roomUsed & bitOf(r_id))) return;
+  RoomNode&  R = roomOf(f_id, r_id);
+  for (uint8_t i = 0; i < SMP_NUM_SINKS; i++){
+    if (!(sink & bitOf(i))) continue;
+    R.dirty[i] = R.dirtyHall[i] = R.dirtyUltra[i] = 0;
+    F.dirtyRooms[i] &= ~bitOf(r_id);
+  }
+}
+void clearFloorDirty(uint8_t f_id, uint8_t sink){
+  if (!inRange(f_id, SMP_MAX_FLOORS)) return;
+  FloorNode& F = MODEL.floors[f_id];
+  for (uint8_t i = 0; i < SMP_NUM_SINKS; i++){
+    if (!(sink & bitOf(i))) continue;
+    F.dirty[i] = 0;
+    for (uint32_t m = F.dirtyRooms[i]; m; m = dropLowest(m)) clearRoomDirty(f_id, lowestBit(m), bitOf(i));
+  }
+}
 
 // ---------------- System-level setters (kept) ----------------
+static inline int hexVal(char c){
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+// "AA:BB:CC:DD:EE:FF" (or '-' separated) in s[0..n) -> 6 bytes
+static bool parseMac(const char* s, size_t n, uint8_t out[6]){
+  while (n && isWs(*s))     { s++; n--; }
+  while (n && isWs(s[n-1])) { n--; }
+  if (n != 17) return false;
+  for (uint8_t i = 0; i < 6; i++){
+    const char* p = s + i*3;
+    int hi = hexVal(p[0]), lo = hexVal(p[1]);
+    if (hi < 0 || lo < 0) return false;
+    if (i < 5 && p[2] != ':' && p[2] != '-') return false;
+    out[i] = (uint8_t)(hi << 4 | lo);
+  }
+  return true;
+}
+static bool applyMac(const char* s, size_t n){
+  uint8_t mac[6];
+  if (!parseMac(s, n, mac)) return false;
+  memcpy(MODEL.mac, mac, 6);
+  MODEL.macSet = true;
+  return true;
+}
+
 bool setSystemState(uint8_t s) { MODEL.systemState = s; return true; }
 bool setKeypad(uint8_t k)      { MODEL.keypad = k;     return true; }
 bool setNetwork(uint8_t n)     { MODEL.network = n;    return true; }
-bool setMac(const String& mac) { MODEL.mac = mac;      return true; }
+bool setMac(const String& mac) { return applyMac(mac.c_str(), mac.length()); }
 
-void resetModel(){ MODEL = ProtocolModel(); }
+// In place: the model can be several KB, too big for a temporary on the stack.
+void resetModel(){
+  MODEL.~ProtocolModel(); new (&MODEL) ProtocolModel();
+  alarmHead = alarmCount = 0;
+}
 
-// ---------------- Topic builders (Node) ----------------
-String nodeTopicSystemState()                    { return "s/st"; }
-String nodeTopicKeypad()                         { return "s/ke"; }
-String nodeTopicNetwork()                        { return "n/st"; }
-String nodeTopicMac()                            { return "n/mc"; }
-String nodeTopicFloorConnection(uint8_t f_id)    { return "f/"+String(f_id)+"/cs"; }
-String nodeTopicFloorTimestamp(uint8_t f_id)     { return "f/"+String(f_id)+"/ts"; }
-String nodeTopicRoomTimestamp(uint8_t f_id,uint8_t r_id){ return "f/"+String(f_id)+"/r/"+String(r_id)+"/ts"; }
+// ---------------- Topic tables (compile time) ----------------
+#define CLOUD_BASE      "ELEC520/security/"
+#define CLOUD_BASE_LEN  (sizeof(CLOUD_BASE) - 1)
+
+namespace {
+
+constexpr size_t digits(size_t v){ return v < 10 ? 1 : 1 + digits(v / 10); }
+
+// Longest topic: ELEC520/security/f/{f}/r/{r}/u/{u}
+constexpr size_t TOPIC_W = CLOUD_BASE_LEN
+                         + 2 + digits(SMP_MAX_FLOORS  - 1)
+                         + 3 + digits(SMP_MAX_ROOMS   - 1)
+                         + 3 + digits(SMP_MAX_SENSORS - 1) + 1;
+
+template <size_t N>
+struct TopicTable {
+  char s[N][TOPIC_W];
+};
+
+constexpr size_t putStr(char* out, size_t n, const char* s){
+  while (*s) out[n++] = *s++;
+  return n;
+}
+constexpr size_t putNum(char* out, size_t n, size_t v){
+  size_t d = digits(v);
+  for (size_t i = d; i > 0; i--){ out[n + i - 1] = (char)('0' + v % 10); v /= 10; }
+  return n + d;
+}
+
+// depth 1: f/{f}{leaf}   depth 2: f/{f}/r/{r}{leaf}   depth 3: f/{f}/r/{r}/{kind}/{id}
+constexpr void writeTopic(char* o, int depth, size_t f, size_t r, const char* kind, size_t id, const char* leaf){
+  size_t n = putStr(o, 0, CLOUD_BASE "f/");
+  n = putNum(o, n, f);
+  if (depth >= 2){ n = putStr(o, n, "/r/"); n = putNum(o, n, r); }
+  if (depth == 3){ n = putStr(o, n, "/"); n = putStr(o, n, kind); n = putStr(o, n, "/"); n = putNum(o, n, id); }
+  n = putStr(o, n, leaf);
+  o[n] = '\0';
+}
+
+template <size_t N>
+constexpr TopicTable<N> makeTopics(int depth, const char* kind, const char* leaf){
+  TopicTable<N> t{};
+  for (size_t i = 0; i < N; i++){
+    size_t f = i, r = 0, id = 0;
+    if (depth == 2){ f = i / SMP_MAX_ROOMS; r = i % SMP_MAX_ROOMS; }
+    if (depth == 3){ f = i / (SMP_MAX_ROOMS * SMP_MAX_SENSORS);
+                     r = (i / SMP_MAX_SENSORS) % SMP_MAX_ROOMS; id = i % SMP_MAX_SENSORS; }
+    writeTopic(t.s[i], depth, f, r, kind, id, leaf);
+  }
+  return t;
+}
+
+constexpr size_t N_FLOOR  = SMP_MAX_FLOORS;
+constexpr size_t N_ROOM   = SMP_MAX_FLOORS * SMP_MAX_ROOMS;
+constexpr size_t N_SENSOR = SMP_MAX_FLOORS * SMP_MAX_ROOMS * SMP_MAX_SENSORS;
+
+constexpr TopicTable<N_FLOOR>  T_FLOOR    = makeTopics<N_FLOOR> (1, "",  "");
+constexpr TopicTable<N_FLOOR>  T_FLOOR_CS = makeTopics<N_FLOOR> (1, "",  "/cs");
+constexpr TopicTable<N_FLOOR>  T_FLOOR_TS = makeTopics<N_FLOOR> (1, "",  "/ts");
+
+inline const char* floorTopic(const TopicTable<N_FLOOR>& t, uint8_t f){
+  return inRange(f, SMP_MAX_FLOORS) ? t.s[f] : "";
+}
+
+#if SMP_SPARSE_ROOMS > 0
+// Sparse model: F*R and F*R*S tables would dwarf the model the option exists
+// to shrink, so room and sensor topics are formatted on demand into a ring
+// of SMP_TOPIC_RING buffers. Each result stays valid for that many further
+// room/sensor topic calls; copy it if it must live longer.
+constexpr char T_ROOM_CS[] = "/cs";
+constexpr char T_ROOM_TS[] = "/ts";
+constexpr char T_ULTRA[]   = "u";
+constexpr char T_HALL[]    = "h";
+
+char* nextTopicBuf(){
+  static char buf[SMP_TOPIC_RING][TOPIC_W];
+  static uint8_t next = 0;
+  char* b = buf[next];
+  next = (uint8_t)((next + 1) % SMP_TOPIC_RING);
+  return b;
+}
+inline const char* roomTopic(const char* leaf, uint8_t f, uint8_t r){
+  if (!inRange(f, SMP_MAX_FLOORS) || !inRange(r, SMP_MAX_ROOMS)) return "";
+  char* b = nextTopicBuf();
+  writeTopic(b, 2, f, r, "", 0, leaf);
+  return b;
+}
+inline const char* sensorTopic(const char* kind, uint8_t f, uint8_t r, uint8_t id){
+  if (!inRange(f, SMP_MAX_FLOORS) || !inRange(r, SMP_MAX_ROOMS) || !inRange(id, SMP_MAX_SENSORS)) return "";
+  char* b = nextTopicBuf();
+  writeTopic(b, 3, f, r, kind, id, "");
+  return b;
+}
+#else
+// Dense model: every room and sensor topic in flash. Generation is bounded
+// by the compiler's constexpr budget and the tables by flash.
+static_assert(N_SENSOR <= SMP_DENSE_TOPIC_MAX,
+              "SMP_MAX_FLOORS*SMP_MAX_ROOMS*SMP_MAX_SENSORS too large for the dense topic tables; "
+              "use SMP_SPARSE_ROOMS");
+constexpr TopicTable<N_ROOM>   T_ROOM_CS  = makeTopics<N_ROOM>  (2, "",  "/cs");
+constexpr TopicTable<N_ROOM>   T_ROOM_TS  = makeTopics<N_ROOM>  (2, "",  "/ts");
+constexpr TopicTable<N_SENSOR> T_ULTRA    = makeTopics<N_SENSOR>(3, "u", "");
+constexpr TopicTable<N_SENSOR> T_HALL     = makeTopics<N_SENSOR>(3, "h", "");
+
+inline const char* roomTopic(const TopicTable<N_ROOM>& t, uint8_t f, uint8_t r){
+  return (inRange(f, SMP_MAX_FLOORS) && inRange(r, SMP_MAX_ROOMS)) ? t.s[f*SMP_MAX_ROOMS + r] : "";
+}
+inline const char* sensorTopic(const TopicTable<N_SENSOR>& t, uint8_t f, uint8_t r, uint8_t id){
+  if (!inRange(f, SMP_MAX_FLOORS) || !inRange(r, SMP_MAX_ROOMS) || !inRange(id, SMP_MAX_SENSORS)) return "";
+  return t.s[(f*SMP_MAX_ROOMS + r)*SMP_MAX_SENSORS + id];
+}
+#endif
+
+constexpr char T_SYSTEM[] = CLOUD_BASE "system";
+constexpr char T_SYS_ST[] = CLOUD_BASE "s/st";
+constexpr char T_SYS_KE[] = CLOUD_BASE "s/ke";
+constexpr char T_NET_ST[] = CLOUD_BASE "n/st";
+constexpr char T_NET_MC[] = CLOUD_BASE "n/mc";
+
+// Node topic = cloud topic minus the prefix ("" stays "").
+inline const char* node(const char* cloud){ return *cloud ? cloud + CLOUD_BASE_LEN : cloud; }
+
+} // namespace
 
 // ---------------- Topic builders (Cloud) ----------------
-static inline String _CLOUD_BASE(){ return "ELEC520/security/"; }
-
-String cloudTopicFloor(uint8_t f_id) {
-  return "ELEC520/security/f/" + String(f_id);
-}
-String cloudTopicSystemState()                    { return _CLOUD_BASE()+"s/st"; }
-String cloudTopicKeypad()                         { return _CLOUD_BASE()+"s/ke"; }
-String cloudTopicNetwork()                        { return _CLOUD_BASE()+"n/st"; }
-String cloudTopicMac()                            { return _CLOUD_BASE()+"n/mc"; }
-String cloudTopicFloorConnection(uint8_t f_id)    { return _CLOUD_BASE()+"f/"+String(f_id)+"/cs"; }
-String cloudTopicRoomConnection(uint8_t f_id,uint8_t r_id){ return _CLOUD_BASE()+"f/"+String(f_id)+"/r/"+String(r_id)+"/cs"; }
-String cloudTopicUltra(uint8_t f_id,uint8_t r_id,uint8_t u_id){ return _CLOUD_BASE()+"f/"+String(f_id)+"/r/"+String(r_id)+"/u/"+String(u_id); }
-String cloudTopicHall(uint8_t f_id,uint8_t r_id,uint8_t hs_id){ return _CLOUD_BASE()+"f/"+String(f_id)+"/r/"+String(r_id)+"/h/"+String(hs_id); }
-String cloudTopicFloorTimestamp(uint8_t f_id)     { return _CLOUD_BASE()+"f/"+String(f_id)+"/ts"; }
-String cloudTopicRoomTimestamp(uint8_t f_id,uint8_t r_id){ return _CLOUD_BASE()+"f/"+String(f_id)+"/r/"+String(r_id)+"/ts"; }
-
-// ---------------- Parsers (INLINED MODEL UPDATES) ----------------
-static bool parseCore(const char* topicC, const char* payloadC, bool cloud){
-  if (!topicC || !payloadC) return false;
+const char* cloudTopicFloor(uint8_t f_id)                            { return floorTopic(T_FLOOR, f_id); }
+const char* cloudTopicSystem()                                       { return T_SYSTEM; }
+const char* cloudTopicSystemState()                                  { return T_SYS_ST; }
+const char* cloudTopicKeypad()                                       { return T_SYS_KE; }
+const char* cloudTopicNetwork()                                      { return T_NET_ST; }
+const char* cloudTopicMac()                                          { return T_NET_MC; }
+const char* cloudTopicFloorConnection(uint8_t f_id)                  { return floorTopic(T_FLOOR_CS, f_id); }
+const char* cloudTopicFloorTimestamp(uint8_t f_id)                   { return floorTopic(T_FLOOR_TS, f_id); }
+const char* cloudTopicRoomConnection(uint8_t f_id,uint8_t r_id)      { return roomTopic(T_ROOM_CS, f_id, r_id); }
+const char* cloudTopicRoomTimestamp(uint8_t f_id,uint8_t r_id)       { return roomTopic(T_ROOM_TS, f_id, r_id); }
+const char* cloudTopicUltra(uint8_t f_id,uint8_t r_id,uint8_t u_id)  { return sensorTopic(T_ULTRA, f_id, r_id, u_id); }
+const char* cloudTopicHall(uint8_t f_id,uint8_t r_id,uint8_t hs_id)  { return sensorTopic(T_HALL, f_id, r_id, hs_id); }
 
-  String t = topicC;
-  String p[12];
-  int n = splitTopic(t, p, 12);
-  if (n <= 0) return false;
+// ---------------- Topic builders (Node) ----------------
+const char* nodeTopicSystemState()                                   { return node(T_SYS_ST); }
+const char* nodeTopicKeypad()                                        { return node(T_SYS_KE); }
+const char* nodeTopicNetwork()                                       { return node(T_NET_ST); }
+const char* nodeTopicMac()                                           { return node(T_NET_MC); }
+const char* nodeTopicFloorConnection(uint8_t f_id)                   { return node(cloudTopicFloorConnection(f_id)); }
+const char* nodeTopicFloorTimestamp(uint8_t f_id)                    { return node(cloudTopicFloorTimestamp(f_id)); }
+const char* nodeTopicRoomConnection(uint8_t f_id,uint8_t r_id)       { return node(cloudTopicRoomConnection(f_id, r_id)); }
+const char* nodeTopicRoomTimestamp(uint8_t f_id,uint8_t r_id)        { return node(cloudTopicRoomTimestamp(f_id, r_id)); }
+const char* nodeTopicUltra(uint8_t f_id,uint8_t r_id,uint8_t u_id)   { return node(cloudTopicUltra(f_id, r_id, u_id)); }
+const char* nodeTopicHall(uint8_t f_id,uint8_t r_id,uint8_t hs_id)   { return node(cloudTopicHall(f_id, r_id, hs_id)); }
+
+// ---------------- Topic tokenizer ----------------
+#define SMP_MAX_TOPIC_SEGS 8   // ELEC520/security/f/{f}/r/{r}/u/{u}
+
+bool parseTopic(const char* topic, size_t len, bool cloud, TopicRef& out){
+  out = TopicRef();
+  if (!topic || len == 0) return false;
+
+  TopicSeg seg[SMP_MAX_TOPIC_SEGS];
+  int n = 0;
+  size_t start = 0;
+  for (size_t i = 0; i <= len; i++){
+    if (i < len && topic[i] != '/') continue;
+    if (n == SMP_MAX_TOPIC_SEGS) return false;
+    seg[n].p = topic + start;
+    seg[n].n = i - start;
+    n++;
+    start = i + 1;
+  }
 
-  int base = 0;
+  const TopicSeg* p = seg;
   if (cloud){
-    if (n < 3 || p[0]!="ELEC520" || p[1]!="security") return false;
-    base = 2;
+    if (n < 3 || !segIs(seg[0],"ELEC520") || !segIs(seg[1],"security")) return false;
+    p += 2; n -= 2;
   }
 
   // s/st, s/ke, n/st, n/mc
-  if (n-base==2 && p[base]=="s" && p[base+1]=="st"){ uint8_t v; if(!parseByte(payloadC,v)) return false; MODEL.systemState=v; return true; }
-  if (n-base==2 && p[base]=="s" && p[base+1]=="ke"){ uint8_t v; if(!parseByte(payloadC,v)) return false; MODEL.keypad=v;      return true; }
-  if (n-base==2 && p[base]=="n" && p[base+1]=="st"){ uint8_t v; if(!parseByte(payloadC,v)) return false; MODEL.network=v;     return true; }
-  if (n-base==2 && p[base]=="n" && p[base+1]=="mc"){ MODEL.mac = String(payloadC); return true; }
-
-  // f/{f}/cs
-  if (n-base==3 && p[base]=="f" && p[base+2]=="cs"){
-    uint8_t f = (uint8_t)p[base+1].toInt();
-    bool b; if(!parseBool01(payloadC,b)) return false;
-    if (!addFloor(f)) return false;
-    MODEL.floors[f].connected = b;
-    return true;
+  if (n == 2){
+    if      (segIs(p[0],"s") && segIs(p[1],"st")) out.kind = TOPIC_SYS_STATE;
+    else if (segIs(p[0],"s") && segIs(p[1],"ke")) out.kind = TOPIC_SYS_KEYPAD;
+    else if (segIs(p[0],"n") && segIs(p[1],"st")) out.kind = TOPIC_NET_STATE;
+    else if (segIs(p[0],"n") && segIs(p[1],"mc")) out.kind = TOPIC_NET_MAC;
+    return out.kind != TOPIC_NONE;
   }
 
-  // f/{f}/ts (Unix)
-  if (n-base==3 && p[base]=="f" && p[base+2]=="ts"){
-    uint8_t f = (uint8_t)p[base+1].toInt();
-    uint32_t ts; if(!parseUint32(payloadC, ts)) return false;
-    if (!addFloor(f)) return false;
-    MODEL.floors[f].ts = ts;
-    return true;
+  // f/{f}/cs | ts
+  if (n < 3 || !segIs(p[0],"f") || !segId(p[1], out.f)) return false;
+  if (n == 3){
+    if      (segIs(p[2],"cs")) out.kind = TOPIC_FLOOR_CS;
+    else if (segIs(p[2],"ts")) out.kind = TOPIC_FLOOR_TS;
+    return out.kind != TOPIC_NONE;
   }
 
-  // f/{f}/r/{r}/cs | u/{u} | h/{h} | ts
-  if (n-base==5 && p[base]=="f" && p[base+2]=="r" && p[base+4]=="cs"){
-    uint8_t f=(uint8_t)p[base+1].toInt(), r=(uint8_t)p[base+3].toInt();
-    bool b; if(!parseBool01(payloadC,b)) return false;
-    if (!addRoom(f,r)) return false;
-    MODEL.floors[f].rooms[r].connected = b;
-    return true;
+  // f/{f}/r/{r}/cs | ts | u/{u} | h/{h}
+  if (n < 5 || !segIs(p[2],"r") || !segId(p[3], out.r)) return false;
+  if (n == 5){
+    if      (segIs(p[4],"cs")) out.kind = TOPIC_ROOM_CS;
+    else if (segIs(p[4],"ts")) out.kind = TOPIC_ROOM_TS;
+    return out.kind != TOPIC_NONE;
   }
-  if (n-base==6 && p[base]=="f" && p[base+2]=="r" && p[base+4]=="u"){
-    uint8_t f=(uint8_t)p[base+1].toInt(), r=(uint8_t)p[base+3].toInt(), u=(uint8_t)p[base+5].toInt();
-    uint8_t v; if(!parseByte(payloadC,v)) return false;
-    if (!addUltra(f,r,u)) return false;
-    MODEL.floors[f].rooms[r].ultra[u].value = v;
-    return true;
-  }
-  if (n-base==6 && p[base]=="f" && p[base+2]=="r" && p[base+4]=="h"){
-    uint8_t f=(uint8_t)p[base+1].toInt(), r=(uint8_t)p[base+3].toInt(), h=(uint8_t)p[base+5].toInt();
-    bool b; if(!parseBool01(payloadC,b)) return false;
-    if (!addHall(f,r,h)) return false;
-    MODEL.floors[f].rooms[r].hall[h].open = b;
-    return true;
-  }
-  if (n-base==6 && p[base]=="f" && p[base+2]=="r" && p[base+4]=="ts"){
-    uint8_t f=(uint8_t)p[base+1].toInt(), r=(uint8_t)p[base+3].toInt();
-    uint32_t ts; if(!parseUint32(payloadC, ts)) return false;
-    if (!addRoom(f,r)) return false;
-    MODEL.floors[f].rooms[r].ts = ts;
-    return true;
+  if (n == 6 && segId(p[5], out.id)){
+    if      (segIs(p[4],"u")) out.kind = TOPIC_ULTRA;
+    else if (segIs(p[4],"h")) out.kind = TOPIC_HALL;
   }
+  return out.kind != TOPIC_NONE;
+}
 
+// ---------------- Apply (INLINED MODEL UPDATES) ----------------
+bool applyTopic(const TopicRef& t, const char* payload, size_t len){
+  if (!payload) return false;
+  uint8_t  v;
+  bool     b;
+  uint32_t ts;
+
+  switch (t.kind){
+    case TOPIC_SYS_STATE:  if(!parseByte(payload,len,v)) return false; MODEL.systemState=v; return true;
+    case TOPIC_SYS_KEYPAD: if(!parseByte(payload,len,v)) return false; MODEL.keypad=v;      return true;
+    case TOPIC_NET_STATE:  if(!parseByte(payload,len,v)) return false; MODEL.network=v;     return true;
+    case TOPIC_NET_MAC:    return applyMac(payload, len);
+
+    case TOPIC_FLOOR_CS: return parseBool01(payload,len,b)  && setFloorConnected(t.f, b);
+    case TOPIC_FLOOR_TS: return parseUint32(payload,len,ts) && setFloorTimestamp(t.f, ts);
+    case TOPIC_ROOM_CS:  return parseBool01(payload,len,b)  && setRoomConnected(t.f, t.r, b);
+    case TOPIC_ROOM_TS:  return parseUint32(payload,len,ts) && setRoomTimestamp(t.f, t.r, ts);
+    case TOPIC_ULTRA:    return parseByte(payload,len,v)    && setUltraValue(t.f, t.r, t.id, v);
+    case TOPIC_HALL:     return parseBool01(payload,len,b)  && setHallOpen(t.f, t.r, t.id, b);
+  }
   return false;
 }
 
+// ---------------- Parsers ----------------
+static bool parseCore(const char* topicC, const char* payloadC, bool cloud){
+  if (!topicC || !payloadC) return false;
+  TopicRef t;
+  if (!parseTopic(topicC, strlen(topicC), cloud, t)) return false;
+  return applyTopic(t, payloadC, strlen(payloadC));
+}
+
 bool parseNode (const char* topic, const char* rawPayload){ return parseCore(topic, rawPayload, false); }
 bool parseCloud(const char* topic, const char* rawPayload){ return parseCore(topic, rawPayload, true ); }
+bool parseCloud(const char* topic, const uint8_t* payload, unsigned int length){
+  if (!topic || !payload) return false;
+  TopicRef t;
+  return parseTopic(topic, strlen(topic), true, t) && applyTopic(t, (const char*)payload, length);
+}
 
 bool parseTokenLine(const String& tokenLine) {
   if (tokenLine.length() == 0) return false;
@@ -184,25 +537,53 @@ bool parseTokenLine(const String& tokenLine) {
 
 // ================= Room ESP compact format (build + parse) =================
 String buildRoomEspString(uint8_t f_id, uint8_t r_id) {
-  addRoom(f_id, r_id);
+  if (!addRoom(f_id, r_id)) return String();
+  const RoomNode& R = roomOf(f_id, r_id);
 
   String msg; msg.reserve(64);
   msg  = "f/"; msg += String(f_id);
   msg += "/r/"; msg += String(r_id);
-  msg += "/cs:"; msg += (MODEL.floors[f_id].rooms[r_id].connected ? "1" : "0");
+  msg += "/cs:"; msg += (R.connected ? "1" : "0");
 
-  for (uint8_t u = 0; u < SMP_MAX_SENSORS; u++) {
-    if (MODEL.floors[f_id].rooms[r_id].ultra[u].used) {
-      msg += ";u/"; msg += String(u);
-      msg += ":";   msg += String(MODEL.floors[f_id].rooms[r_id].ultra[u].value);
-    }
+  for (uint32_t m = R.ultraUsed; m; m = dropLowest(m)) {
+    uint8_t u = lowestBit(m);
+    msg += ";u/"; msg += String(u);
+    msg += ":";   msg += String(R.ultra[u]);
   }
-  for (uint8_t h = 0; h < SMP_MAX_SENSORS; h++) {
-    if (MODEL.floors[f_id].rooms[r_id].hall[h].used) {
-      msg += ";h/"; msg += String(h);
-      msg += ":";   msg += (MODEL.floors[f_id].rooms[r_id].hall[h].open ? "1" : "0");
-    }
+  for (uint32_t m = R.hallUsed; m; m = dropLowest(m)) {
+    uint8_t h = lowestBit(m);
+    msg += ";h/"; msg += String(h);
+    msg += ":";   msg += ((R.hallOpen & bitOf(h)) ? "1" : "0");
+  }
+  return msg;
+}
+
+String buildRoomDeltaString(uint8_t f_id, uint8_t r_id, uint8_t sink) {
+  // The room string has no ts field: a room whose only change is its
+  // timestamp has nothing to send, so clear it rather than send a bare header.
+  if (!isRoomDataDirty(f_id, r_id, sink)) { clearRoomDirty(f_id, r_id, sink); return String(); }
+  const RoomNode& R = roomOf(f_id, r_id);
+  bool cs = forSinks(R.dirty, sink) & DIRTY_CS;
+  uint32_t ultras = R.ultraUsed & forSinks(R.dirtyUltra, sink);
+  uint32_t halls  = R.hallUsed  & forSinks(R.dirtyHall,  sink);
+
+  String msg; msg.reserve(64);
+  msg  = "f/"; msg += String(f_id);
+  msg += "/r/"; msg += String(r_id);
+  if (cs) { msg += "/cs:"; msg += (R.connected ? "1" : "0"); }
+
+  for (uint32_t m = ultras; m; m = dropLowest(m)) {
+    uint8_t u = lowestBit(m);
+    msg += ";u/"; msg += String(u);
+    msg += ":";   msg += String(R.ultra[u]);
   }
+  for (uint32_t m = halls; m; m = dropLowest(m)) {
+    uint8_t h = lowestBit(m);
+    msg += ";h/"; msg += String(h);
+    msg += ":";   msg += ((R.hallOpen & bitOf(h)) ? "1" : "0");
+  }
+
+  clearRoomDirty(f_id, r_id, sink);
   return msg;
 }
 
@@ -255,7 +636,7 @@ bool parseRoomEspString(const String& roomData) {
     int csi = t.indexOf("cs:");
     if (csi >= 0) {
       bool cs = (t.substring(csi + 3).toInt() != 0);
-      MODEL.floors[f_id].rooms[r_id].connected = cs;
+      setRoomConnected(f_id, r_id, cs);
       continue;
     }
 
@@ -264,9 +645,7 @@ bool parseRoomEspString(const String& roomData) {
       if (colon > 2) {
         uint8_t u_id = (uint8_t)t.substring(2, colon).toInt();
         uint8_t val  = (uint8_t)t.substring(colon + 1).toInt();
-        if (addUltra(f_id, r_id, u_id)) {
-          MODEL.floors[f_id].rooms[r_id].ultra[u_id].value = val;
-        }
+        setUltraValue(f_id, r_id, u_id, val);
       }
       continue;
     }
@@ -276,9 +655,7 @@ bool parseRoomEspString(const String& roomData) {
       if (colon > 2) {
         uint8_t hs_id = (uint8_t)t.substring(2, colon).toInt();
         bool open01   = (t.substring(colon + 1).toInt() != 0);
-        if (addHall(f_id, r_id, hs_id)) {
-          MODEL.floors[f_id].rooms[r_id].hall[hs_id].open = open01;
-        }
+        setHallOpen(f_id, r_id, hs_id, open01);
       }
       continue;
     }
@@ -287,142 +664,358 @@ bool parseRoomEspString(const String& roomData) {
   return true;
 }
 
-// ---------------- MQTT full-system compact string ----------------
-// Payload example:
-//   "s/st:1;s/ke:0;n/st:1;n/mc:AA:BB:CC:DD:EE:FF;
-//    f/0/cs:1;f/0/ts:1698312345;f/0/r/0/cs:1;f/0/r/0/ts:1698312390;
-//    f/0/r/0/u/0:87;f/0/r/0/h/0:1;f/1/cs:0; ..."
-String buildSystemMqttString() {
-  String out;
-  out.reserve(1024); // adjust if your model is large
-
-  auto add = [&](const String& token){
-    if (token.length() == 0) return;
-    if (out.length() > 0 && out[out.length()-1] != ';') out += ';';
-    out += token;
-  };
-
-  // System-level
-  add("s/st:" + String(MODEL.systemState));
-  add("s/ke:" + String(MODEL.keypad));
-  add("n/st:" + String(MODEL.network));
-  if (MODEL.mac.length() > 0) add("n/mc:" + MODEL.mac);
-
-  // Floors, rooms, sensors
-  for (uint8_t f = 0; f < SMP_MAX_FLOORS; ++f) {
-    FloorNode& F = MODEL.floors[f];
-    if (!F.used) continue;
+// ================= Room ESP binary frame (build + parse) =================
+static inline void putMask(uint8_t* p, uint32_t m){
+  for (uint8_t i = 0; i < SMP_SENSOR_MASK_BYTES; i++) p[i] = (uint8_t)(m >> (8 * i));
+}
+static inline uint32_t getMask(const uint8_t* p){
+  uint32_t m = 0;
+  for (uint8_t i = 0; i < SMP_SENSOR_MASK_BYTES; i++) m |= (uint32_t)p[i] << (8 * i);
+  return m;
+}
 
-    add("f/" + String(f) + "/cs:" + String(F.connected ? "1" : "0"));
-    if (F.ts != 0) add("f/" + String(f) + "/ts:" + String(F.ts));
+// A room record is a room frame without its header byte, so single-room and
+// batch frames share one encoder/decoder. The masks are the RoomNode masks,
+// so both directions are copies.
+#define ROOM_RECORD_FIXED_LEN (ROOM_FRAME_FIXED_LEN - 1)
 
-    for (uint8_t r = 0; r < SMP_MAX_ROOMS; ++r) {
-      RoomNode& R = F.rooms[r];
-      if (!R.used) continue;
+static size_t roomRecordLen(uint8_t f_id, uint8_t r_id) {
+  return ROOM_RECORD_FIXED_LEN + popCount(roomOf(f_id, r_id).ultraUsed);
+}
 
-      add("f/" + String(f) + "/r/" + String(r) + "/cs:" + String(R.connected ? "1" : "0"));
-      if (R.ts != 0) add("f/" + String(f) + "/r/" + String(r) + "/ts:" + String(R.ts));
+// Caller checks the room exists and p has roomRecordLen() bytes.
+static size_t writeRoomRecord(uint8_t f_id, uint8_t r_id, uint8_t* p) {
+  const RoomNode& R = roomOf(f_id, r_id);
+  p[0] = f_id;
+  p[1] = r_id;
+  p[2] = R.connected ? 0x01 : 0x00;
+  putMask(p + 3,                             R.hallUsed);
+  putMask(p + 3 +     SMP_SENSOR_MASK_BYTES,   R.hallOpen & R.hallUsed);
+  putMask(p + 3 + 2 * SMP_SENSOR_MASK_BYTES,   R.ultraUsed);
+  uint8_t* uv = p + ROOM_RECORD_FIXED_LEN;
+  for (uint32_t m = R.ultraUsed; m; m = dropLowest(m)) *uv++ = R.ultra[lowestBit(m)];
+  return (size_t)(uv - p);
+}
 
-      for (uint8_t u = 0; u < SMP_MAX_SENSORS; ++u) {
-        if (!R.ultra[u].used) continue;
-        add("f/" + String(f) + "/r/" + String(r) + "/u/" + String(u) + ":" + String(R.ultra[u].value));
-      }
-      for (uint8_t h = 0; h < SMP_MAX_SENSORS; ++h) {
-        if (!R.hall[h].used) continue;
-        add("f/" + String(f) + "/r/" + String(r) + "/h/" + String(h) + ":" + String(R.hall[h].open ? "1" : "0"));
-      }
-    }
+// Applies one record from p[0..avail); returns its length, 0 if malformed.
+static size_t parseRoomRecord(const uint8_t* p, size_t avail) {
+  if (avail < ROOM_RECORD_FIXED_LEN) return 0;
+  uint32_t hallUsed  = getMask(p + 3);
+  uint32_t hallOpen  = getMask(p + 3 +     SMP_SENSOR_MASK_BYTES);
+  uint32_t ultraUsed = getMask(p + 3 + 2 * SMP_SENSOR_MASK_BYTES);
+  size_t n = ROOM_RECORD_FIXED_LEN + popCount(ultraUsed);
+  if (avail < n) return 0;
+
+  uint8_t f_id = p[0], r_id = p[1];
+  if (!setRoomConnected(f_id, r_id, (p[2] & 0x01) != 0)) return 0;
+
+  for (uint32_t m = hallUsed; m; m = dropLowest(m)) {
+    uint8_t h = lowestBit(m);
+    setHallOpen(f_id, r_id, h, (hallOpen & bitOf(h)) != 0);
   }
+  const uint8_t* uv = p + ROOM_RECORD_FIXED_LEN;
+  for (uint32_t m = ultraUsed; m; m = dropLowest(m)) setUltraValue(f_id, r_id, lowestBit(m), *uv++);
+  return n;
+}
 
-  // Ensure no stray leading ';'
-  if (out.startsWith(";")) out.remove(0, 1);
-  return out;
+size_t buildRoomEspFrame(uint8_t f_id, uint8_t r_id, uint8_t* buf, size_t cap) {
+  if (!buf || !addRoom(f_id, r_id)) return 0;
+  if (cap < 1 + roomRecordLen(f_id, r_id)) return 0;
+  buf[0] = ROOM_FRAME_HDR;
+  return 1 + writeRoomRecord(f_id, r_id, buf + 1);
 }
 
+bool isRoomEspFrame(const uint8_t* data, size_t len) {
+  return data && len >= ROOM_FRAME_FIXED_LEN && (data[0] & 0xF0) == 0xA0;
+}
 
-// ---------------- Parse MQTT full-system compact string ----------------
-bool parseSystemMqttString(const String& systemData) {
-  if (systemData.length() == 0) return false;
+bool parseRoomEspFrame(const uint8_t* data, size_t len) {
+  if (!isRoomEspFrame(data, len) || data[0] != ROOM_FRAME_HDR) return false;
+  return parseRoomRecord(data + 1, len - 1) == len - 1;
+}
 
-  String tokens[256];
-  int count = 0, start = 0;
-  while (count < 256) {
-    int idx = systemData.indexOf(';', start);
-    String part = (idx == -1) ? systemData.substring(start)
-                              : systemData.substring(start, idx);
-    part.trim();
-    if (part.length() > 0) tokens[count++] = part;
-    if (idx == -1) break;
-    start = idx + 1;
-  }
+// ================= Multi-room ESP batch frame =================
+size_t beginRoomBatch(uint8_t* buf, size_t cap) {
+  if (!buf || cap < ROOM_BATCH_FIXED_LEN) return 0;
+  buf[0] = ROOM_BATCH_HDR;
+  buf[1] = 0;
+  return ROOM_BATCH_FIXED_LEN;
+}
 
-  bool anyParsed = false;
-  for (int i = 0; i < count; i++) {
-    const String& token = tokens[i];
-    int colon = token.indexOf(':');
-    if (colon <= 0) continue;
+size_t appendRoomToBatch(uint8_t f_id, uint8_t r_id, uint8_t* buf, size_t len, size_t cap) {
+  if (!buf || len < ROOM_BATCH_FIXED_LEN || buf[1] == 0xFF || !addRoom(f_id, r_id)) return 0;
+  if (len + roomRecordLen(f_id, r_id) > cap) return 0;
+  len += writeRoomRecord(f_id, r_id, buf + len);
+  buf[1]++;
+  return len;
+}
 
-    String topic = token.substring(0, colon);
-    String payload = token.substring(colon + 1);
+// Lookup only: unlike appendRoomToBatch() it never adds the room.
+size_t measureRoomRecord(uint8_t f_id, uint8_t r_id) {
+  if (!inRange(f_id, SMP_MAX_FLOORS) || !inRange(r_id, SMP_MAX_ROOMS) || !MODEL.room(f_id, r_id)) return 0;
+  return roomRecordLen(f_id, r_id);
+}
 
-    topic.trim();
-    payload.trim();
+bool isRoomBatchFrame(const uint8_t* data, size_t len) {
+  return data && len >= ROOM_BATCH_FIXED_LEN && (data[0] & 0xF0) == 0xB0;
+}
 
-    if (parseNode(topic.c_str(), payload.c_str())) {
-      anyParsed = true;
+// Records before a malformed one are kept; returns false if any was bad.
+bool parseRoomBatchFrame(const uint8_t* data, size_t len) {
+  if (!isRoomBatchFrame(data, len) || data[0] != ROOM_BATCH_HDR) return false;
+  size_t pos = ROOM_BATCH_FIXED_LEN;
+  for (uint8_t i = 0; i < data[1]; i++) {
+    size_t n = parseRoomRecord(data + pos, len - pos);
+    if (n == 0) return false;
+    pos += n;
+  }
+  return pos == len;
+}
+
+// Text batch: room strings joined with '\n'.
+bool parseRoomEspText(const char* data, size_t len) {
+  if (!data) return false;
+  bool ok = true;
+  size_t start = 0;
+  for (size_t i = 0; i <= len; i++) {
+    if (i < len && data[i] != '\n') continue;
+    if (i > start) {
+      String line;
+      line.concat(data + start, (unsigned)(i - start));
+      ok = parseRoomEspString(line) && ok;
     }
+    start = i + 1;
   }
+  return ok;
+}
 
-    return anyParsed;
+// ---------------- Streaming serializers ----------------
+// Tokens are written straight to a Print (Serial, PubSubClient between
+// beginPublish/endPublish, a String adaptor, ...) with no temporary Strings.
+
+namespace {
+
+// Counts bytes instead of writing them (measure pass).
+class CountingPrint : public Print {
+public:
+  size_t write(uint8_t) override { return 1; }
+  size_t write(const uint8_t*, size_t n) override { return n; }
+};
+
+// Fills buf with whole tokens and hands it on at each ';' that would
+// overflow it; the ';' itself is dropped at the split.
+class ChunkPrint : public Print {
+public:
+  ChunkPrint(char* buf, size_t cap, SmpChunkFn emit, void* ctx) : _buf(buf), _cap(cap), _emit(emit), _ctx(ctx) {}
+  size_t write(uint8_t c) override {
+    if (_failed) return 1;
+    if (_n == _cap) {
+      if (_cut == 0) { _failed = true; return 1; }        // token longer than a message
+      if (!send(_cut - 1)) return 1;
+      memmove(_buf, _buf + _cut, _n - _cut);
+      _n -= _cut;
+      _cut = 0;
+    }
+    if (c == ';' && _n == 0) return 1;
+    _buf[_n++] = (char)c;
+    if (c == ';') _cut = _n;
+    return 1;
+  }
+  size_t write(const uint8_t* buf, size_t n) override { for (size_t i = 0; i < n; i++) write(buf[i]); return n; }
+  size_t finish() { if (_n && !_failed) send(_n); return _failed ? 0 : _sent; }
+private:
+  bool send(size_t len) {
+    if (!_emit(_buf, len, _ctx)) { _failed = true; return false; }
+    _sent++;
+    return true;
+  }
+  char* _buf;
+  size_t _cap, _n = 0, _cut = 0, _sent = 0;
+  SmpChunkFn _emit;
+  void* _ctx;
+  bool _failed = false;
+};
+
+// Appends to a String reserved from the measure pass.
+class StringPrint : public Print {
+public:
+  explicit StringPrint(String& s) : _s(s) {}
+  size_t write(uint8_t c) override { _s += (char)c; return 1; }
+  size_t write(const uint8_t* buf, size_t n) override { _s.concat((const char*)buf, n); return n; }
+private:
+  String& _s;
+};
+
+// ';'-separated token writer that counts what it emits.
+struct TokenWriter {
+  Print& out;
+  size_t n = 0;
+  bool   first = true;
+
+  explicit TokenWriter(Print& p) : out(p) {}
+  void sep()                 { if (!first) n += out.write((uint8_t)';'); first = false; }
+  void str(const char* s)    { n += out.print(s); }
+  void num(uint32_t v)       { n += out.print((unsigned long)v); }
+  void bit(bool b)           { n += out.write((uint8_t)(b ? '1' : '0')); }
+  void mac(const uint8_t m[6]) {
+    static const char HEX_DIGITS[] = "0123456789ABCDEF";
+    for (uint8_t i = 0; i < 6; i++){
+      if (i) n += out.write((uint8_t)':');
+      n += out.write((uint8_t)HEX_DIGITS[m[i] >> 4]);
+      n += out.write((uint8_t)HEX_DIGITS[m[i] & 0x0F]);
+    }
+  }
+  // "f/{f}/" in system form, nothing in per-floor form
+  void floorPrefix(bool sys, uint8_t f) { if (sys){ str("f/"); num(f); n += out.write((uint8_t)'/'); } }
+  void roomPrefix (bool sys, uint8_t f, uint8_t r) { floorPrefix(sys, f); str("r/"); num(r); }
+};
+
+} // namespace
+
+// sink == 0 writes every used field; otherwise only fields dirty for that sink.
+// sys selects the "f/{f}/..." system form over the per-floor "cs:..;r/{r}/..." form.
+static void writeFloorTokens(TokenWriter& w, uint8_t f, uint8_t sink, bool sys) {
+  const FloorNode& F = MODEL.floors[f];
+  const uint32_t ALL = 0xFFFFFFFFUL;
+
+  uint32_t own = sink ? forSinks(F.dirty, sink) : ALL;
+  if (own & DIRTY_CS) { w.sep(); w.floorPrefix(sys, f); w.str("cs:"); w.bit(F.connected); }
+  if ((own & DIRTY_TS) && F.ts != 0) { w.sep(); w.floorPrefix(sys, f); w.str("ts:"); w.num(F.ts); }
+
+  uint32_t rooms = F.roomUsed & (sink ? forSinks(F.dirtyRooms, sink) : ALL);
+  for (; rooms; rooms = dropLowest(rooms)) {
+    uint8_t r = lowestBit(rooms);
+    const RoomNode& R = roomOf(f, r);
+
+    uint32_t rown = sink ? forSinks(R.dirty, sink) : ALL;
+    if (rown & DIRTY_CS) { w.sep(); w.roomPrefix(sys, f, r); w.str("/cs:"); w.bit(R.connected); }
+    if ((rown & DIRTY_TS) && R.ts != 0) { w.sep(); w.roomPrefix(sys, f, r); w.str("/ts:"); w.num(R.ts); }
+
+    for (uint32_t m = R.ultraUsed & (sink ? forSinks(R.dirtyUltra, sink) : ALL); m; m = dropLowest(m)) {
+      uint8_t u = lowestBit(m);
+      w.sep(); w.roomPrefix(sys, f, r); w.str("/u/"); w.num(u); w.str(":"); w.num(R.ultra[u]);
+    }
+    for (uint32_t m = R.hallUsed & (sink ? forSinks(R.dirtyHall, sink) : ALL); m; m = dropLowest(m)) {
+      uint8_t h = lowestBit(m);
+      w.sep(); w.roomPrefix(sys, f, r); w.str("/h/"); w.num(h); w.str(":"); w.bit(R.hallOpen & bitOf(h));
+    }
+  }
 }
 
-  String buildFloorMqttString(uint8_t f_id) {
-    if (f_id >= SMP_MAX_FLOORS) return String();
+size_t writeSystemMqtt(Print& out) {
+  TokenWriter w(out);
 
-    FloorNode& F = MODEL.floors[f_id];
-    if (!F.used) return String();
+  // System-level
+  w.sep(); w.str("s/st:"); w.num(MODEL.systemState);
+  w.sep(); w.str("s/ke:"); w.num(MODEL.keypad);
+  w.sep(); w.str("n/st:"); w.num(MODEL.network);
+  if (MODEL.macSet) { w.sep(); w.str("n/mc:"); w.mac(MODEL.mac); }
 
-    String out;
-    out.reserve(160);
+  // Floors, rooms, sensors
+  for (uint32_t m = MODEL.floorUsed; m; m = dropLowest(m)) writeFloorTokens(w, lowestBit(m), 0, true);
+  return w.n;
+}
 
-    // Floor connection + timestamp
-    out += "cs:"; out += (F.connected ? "1" : "0");
-    if (F.ts != 0) {
-      out += ";ts:"; out += String(F.ts);
-    }
+size_t writeFloorMqtt(Print& out, uint8_t f_id) {
+  if (!inRange(f_id, SMP_MAX_FLOORS) || !(MODEL.floorUsed & bitOf(f_id))) return 0;
+  TokenWriter w(out);
+  writeFloorTokens(w, f_id, 0, false);
+  return w.n;
+}
 
-  // Rooms
-  for (uint8_t r = 0; r < SMP_MAX_ROOMS; ++r) {
-    RoomNode& R = F.rooms[r];
-    if (!R.used) continue;
+size_t writeFloorDeltaMqtt(Print& out, uint8_t f_id, uint8_t sink) {
+  if (sink == 0 || !isFloorDirty(f_id, sink)) return 0;
+  TokenWriter w(out);
+  writeFloorTokens(w, f_id, sink, false);
+  return w.n;
+}
 
-    // Room connection
-    out += ";r/"; out += String(r);
-    out += "/cs:"; out += (R.connected ? "1" : "0");
+size_t measureSystemMqtt()                           { CountingPrint c; return writeSystemMqtt(c); }
 
-    // Room timestamp
-    if (R.ts != 0) {
-      out += ";r/"; out += String(r);
-      out += "/ts:"; out += String(R.ts);
-    }
+size_t writeSystemMqttChunked(char* buf, size_t cap, SmpChunkFn emit, void* ctx) {
+  if (!buf || cap == 0 || !emit) return 0;
+  ChunkPrint c(buf, cap, emit, ctx);
+  writeSystemMqtt(c);
+  return c.finish();
+}
+size_t measureFloorMqtt(uint8_t f_id)                { CountingPrint c; return writeFloorMqtt(c, f_id); }
+size_t measureFloorDeltaMqtt(uint8_t f_id, uint8_t sink){ CountingPrint c; return writeFloorDeltaMqtt(c, f_id, sink); }
 
-    // Ultrasonic sensors
-    for (uint8_t u = 0; u < SMP_MAX_SENSORS; ++u) {
-      if (!R.ultra[u].used) continue;
-      out += ";r/"; out += String(r);
-      out += "/u/"; out += String(u);
-      out += ":";   out += String(R.ultra[u].value);
-    }
+// ---------------- MQTT full-system compact string ----------------
+// Payload example:
+//   "s/st:1;s/ke:0;n/st:1;n/mc:AA:BB:CC:DD:EE:FF;
+//    f/0/cs:1;f/0/ts:1698312345;f/0/r/0/cs:1;f/0/r/0/ts:1698312390;
+//    f/0/r/0/u/0:87;f/0/r/0/h/0:1;f/1/cs:0; ..."
+String buildSystemMqttString() {
+  String out;
+  out.reserve(measureSystemMqtt());
+  StringPrint sp(out);
+  writeSystemMqtt(sp);
+  return out;
+}
 
-    // Hall sensors
-    for (uint8_t h = 0; h < SMP_MAX_SENSORS; ++h) {
-      if (!R.hall[h].used) continue;
-      out += ";r/"; out += String(r);
-      out += "/h/"; out += String(h);
-      out += ":";   out += (R.hall[h].open ? "1" : "0");
+// ---------------- Parse MQTT full-system compact string ----------------
+// Single pass over data[0..len): each "topic:value" token is located with a
+// cursor, trimmed in place and applied to MODEL. No copies, O(1) memory, and
+// data need not be NUL-terminated (PubSubClient payloads are not).
+bool parseSystemMqtt(const char* data, size_t len) {
+  if (!data || len == 0) return false;
+
+  bool anyParsed = false;
+  const char* end = data + len;
+  const char* cur = data;
+  while (cur < end) {
+    const char* tokEnd = cur;
+    while (tokEnd < end && *tokEnd != ';') tokEnd++;
+
+    const char* colon = cur;
+    while (colon < tokEnd && *colon != ':') colon++;
+
+    if (colon < tokEnd) {
+      const char* tb = cur;       const char* te = colon;
+      const char* pb = colon + 1; const char* pe = tokEnd;
+      while (tb < te && isWs(*tb))     tb++;
+      while (te > tb && isWs(te[-1]))  te--;
+      while (pb < pe && isWs(*pb))     pb++;
+      while (pe > pb && isWs(pe[-1]))  pe--;
+
+      TopicRef t;
+      if (te > tb && parseTopic(tb, (size_t)(te - tb), false, t) &&
+          applyTopic(t, pb, (size_t)(pe - pb))) {
+        anyParsed = true;
+      }
     }
+    cur = tokEnd + 1;
   }
+  return anyParsed;
+}
+
+bool parseSystemMqtt(const uint8_t* payload, unsigned int length) {
+  return parseSystemMqtt((const char*)payload, (size_t)length);
+}
+
+bool parseSystemMqttString(const String& systemData) {
+  return parseSystemMqtt(systemData.c_str(), systemData.length());
+}
 
+String buildFloorMqttString(uint8_t f_id) {
+  String out;
+  size_t n = measureFloorMqtt(f_id);
+  if (n == 0) return out;
+  out.reserve(n);
+  StringPrint sp(out);
+  writeFloorMqtt(sp, f_id);
+  return out;
+}
+
+String buildFloorDeltaString(uint8_t f_id, uint8_t sink) {
+  String out;
+  size_t n = measureFloorDeltaMqtt(f_id, sink);
+  if (n == 0) return out;
+  out.reserve(n);
+  StringPrint sp(out);
+  writeFloorDeltaMqtt(sp, f_id, sink);
+  clearFloorDirty(f_id, sink);
   return out;
 }
 
@@ -434,12 +1027,14 @@ void debugPrintModel(Stream& out) {
   out.print(F("System State (s/st): ")); out.println(MODEL.systemState);
   out.print(F("Keypad      (s/ke): ")); out.println(MODEL.keypad);
   out.print(F("Network     (n/st): ")); out.println(MODEL.network);
-  out.print(F("MAC         (n/mc): ")); out.println(MODEL.mac);
+  out.print(F("MAC         (n/mc): "));
+  if (MODEL.macSet) { TokenWriter w(out); w.mac(MODEL.mac); }
+  out.println();
 
   // Floors
-  for (uint8_t f = 0; f < SMP_MAX_FLOORS; ++f) {
-    FloorNode& F = MODEL.floors[f];
-    if (!F.used) continue;
+  for (uint32_t fm = MODEL.floorUsed; fm; fm = dropLowest(fm)) {
+    uint8_t f = lowestBit(fm);
+    const FloorNode& F = MODEL.floors[f];
 
     out.println();
     out.print  (F("Floor ")); out.print(f);
@@ -447,34 +1042,31 @@ void debugPrintModel(Stream& out) {
     out.print  (F("         ts: ")); out.println(F.ts);
 
     // Rooms
-    for (uint8_t r = 0; r < SMP_MAX_ROOMS; ++r) {
-      RoomNode& R = F.rooms[r];
-      if (!R.used) continue;
+    for (uint32_t rm = F.roomUsed; rm; rm = dropLowest(rm)) {
+      uint8_t r = lowestBit(rm);
+      const RoomNode& R = roomOf(f, r);
 
       out.print  (F("  Room ")); out.print(r);
       out.print  (F("   connected: ")); out.println(R.connected ? F("1") : F("0"));
       out.print  (F("           ts: ")); out.println(R.ts);
 
       // Ultrasonic sensors
-      bool anyU = false;
-      for (uint8_t u = 0; u < SMP_MAX_SENSORS; ++u) {
-        if (!R.ultra[u].used) continue;
-        if (!anyU) { out.println(F("    Ultra:")); anyU = true; }
+      if (R.ultraUsed) out.println(F("    Ultra:"));
+      for (uint32_t m = R.ultraUsed; m; m = dropLowest(m)) {
+        uint8_t u = lowestBit(m);
         out.print(F("      u/")); out.print(u);
-        out.print(F(" = ")); out.println(R.ultra[u].value);
+        out.print(F(" = ")); out.println(R.ultra[u]);
       }
 
       // Hall sensors
-      bool anyH = false;
-      for (uint8_t h = 0; h < SMP_MAX_SENSORS; ++h) {
-        if (!R.hall[h].used) continue;
-        if (!anyH) { out.println(F("    Hall:")); anyH = true; }
+      if (R.hallUsed) out.println(F("    Hall:"));
+      for (uint32_t m = R.hallUsed; m; m = dropLowest(m)) {
+        uint8_t h = lowestBit(m);
         out.print(F("      h/")); out.print(h);
-        out.print(F(" = ")); out.println(R.hall[h].open ? F("1") : F("0"));
+        out.print(F(" = ")); out.println((R.hallOpen & bitOf(h)) ? F("1") : F("0"));
       }
     }
   }
 
   out.println(F("=== END MODEL DUMP ==="));
 }
-
@@ -4,44 +4,148 @@
 #include <Arduino.h>
 
 // -------- Limits --------
+// Override with build flags (e.g. -DSMP_MAX_ROOMS=24). Each limit may be up
+// to 32; the bit masks below widen to match. The dense model also keeps every
+// room/sensor topic in compile-time tables, which caps F*R*S at
+// SMP_DENSE_TOPIC_MAX (16x16x16, ~300 KB of tables). Larger sites use the
+// sparse model, which formats those topics on demand.
+#ifndef SMP_MAX_FLOORS
 #define SMP_MAX_FLOORS   8
+#endif
+#ifndef SMP_MAX_ROOMS
 #define SMP_MAX_ROOMS    8
+#endif
+#ifndef SMP_MAX_SENSORS
 #define SMP_MAX_SENSORS  8
+#endif
+// 0 = DenseModel (a slot for every floor x room). N > 0 = SparseModel holding
+// at most N rooms in total, for sites with many room IDs but few rooms used.
+#ifndef SMP_SPARSE_ROOMS
+#define SMP_SPARSE_ROOMS 0
+#endif
+#ifndef SMP_DENSE_TOPIC_MAX
+#define SMP_DENSE_TOPIC_MAX 4096
+#endif
 
 // -------- Enums --------
 enum SystemState : uint8_t { DISARMED=0, ARMED=1, ALARM=2, OTHER=3 };
 enum KeypadState : uint8_t { NO_INPUT=0, ACCEPTED=1, DECLINED=2 };
 
-// -------- Data Structures --------
-struct UltraSensor {
-  bool     used  = false;
-  uint8_t  value = 0;
+// Change tracking: every dirty mask is kept once per sink, so ESP-NOW and MQTT
+// each see every change once. Setters/adders/parsers mark all sinks, delta
+// builders clear only their own.
+enum DirtySink : uint8_t { SINK_ESP = 0x01, SINK_MQTT = 0x02, SINK_ALL = 0x03 };
+#define SMP_NUM_SINKS 2
+
+// Dirty bits for a floor's / room's own fields
+enum : uint8_t { DIRTY_CS = 0x01, DIRTY_TS = 0x02 };
+
+// -------- Data Structures (bit-packed) --------
+// Bit n of a mask is sensor / room / floor n. Iteration walks the set bits
+// only, so unused slots cost nothing in the build and parse loops.
+template <bool Fits8, bool Fits16> struct SmpMaskSel          { typedef uint32_t type; };
+template <bool Fits16>             struct SmpMaskSel<true, Fits16> { typedef uint8_t  type; };
+template <>                        struct SmpMaskSel<false, true>  { typedef uint16_t type; };
+template <uint8_t N> using SmpMask = typename SmpMaskSel<(N <= 8), (N <= 16)>::type;
+
+template <uint8_t S>
+struct RoomNodeT {
+  typedef SmpMask<S> Mask;
+  uint8_t  connected = 0;                    // f/{f}/r/{r}/cs
+  Mask     hallUsed  = 0;                    // h/{h} present
+  Mask     hallOpen  = 0;                    // h/{h} open
+  Mask     ultraUsed = 0;                    // u/{u} present
+  uint32_t ts        = 0;                    // f/{f}/r/{r}/ts (Unix)
+  uint8_t  ultra[S]  = {};                   // u/{u} value, valid where ultraUsed is set
+  uint8_t  dirty     [SMP_NUM_SINKS] = {};   // DIRTY_CS | DIRTY_TS
+  Mask     dirtyHall [SMP_NUM_SINKS] = {};
+  Mask     dirtyUltra[SMP_NUM_SINKS] = {};
 };
-struct HallSensor {
-  bool used = false;
-  bool open = false;
+
+// Floor fields only; where the rooms live is up to the model.
+template <uint8_t R>
+struct FloorNodeT {
+  typedef SmpMask<R> Mask;
+  uint8_t  connected = 0;                    // f/{f}/cs
+  Mask     roomUsed  = 0;                    // room r present
+  uint8_t  dirty     [SMP_NUM_SINKS] = {};   // DIRTY_CS | DIRTY_TS
+  Mask     dirtyRooms[SMP_NUM_SINKS] = {};   // room r has dirty fields
+  uint32_t ts        = 0;                    // f/{f}/ts (Unix)
 };
-struct RoomNode {
-  bool     used       = false;
-  bool     connected  = false; // f/{f}/r/{r}/cs
-  uint32_t ts         = 0;     // f/{f}/r/{r}/ts (Unix)
-  UltraSensor ultra[SMP_MAX_SENSORS];
-  HallSensor  hall [SMP_MAX_SENSORS];
+
+// System fields and floors, shared by both models.
+template <uint8_t F, uint8_t R, uint8_t S>
+struct ModelBaseT {
+  static_assert(F >= 1 && F <= 32 && R >= 1 && R <= 32 && S >= 1 && S <= 32,
+                "model dimensions must be 1..32");
+  typedef RoomNodeT<S>  Room;
+  typedef FloorNodeT<R> Floor;
+  static const uint8_t MAX_FLOORS = F, MAX_ROOMS = R, MAX_SENSORS = S;
+
+  uint8_t    systemState = DISARMED; // s/st
+  uint8_t    keypad      = NO_INPUT; // s/ke
+  uint8_t    network     = 0;        // n/st
+  bool       macSet      = false;
+  uint8_t    mac[6]      = {};       // n/mc
+  SmpMask<F> floorUsed   = 0;        // floor f present
+  Floor      floors[F];              // f/{f}
 };
-struct FloorNode {
-  bool     used       = false;
-  bool     connected  = false; // f/{f}/cs
-  uint32_t ts         = 0;     // f/{f}/ts (Unix)
-  RoomNode rooms[SMP_MAX_ROOMS];
+
+// Every model provides room(f, r) -> used room or nullptr, and
+// allocRoom(f, r) -> storage for a new room or nullptr when full. The library
+// only reaches rooms through these, so it runs unchanged against either.
+
+// A slot for every floor x room: O(1) lookup, F*R*sizeof(Room) bytes.
+template <uint8_t F, uint8_t R, uint8_t S>
+struct DenseModel : ModelBaseT<F, R, S> {
+  typedef RoomNodeT<S> Room;
+  Room slots[F][R];
+
+  Room* room(uint8_t f, uint8_t r) {
+    return (this->floors[f].roomUsed >> r) & 1 ? &slots[f][r] : nullptr;
+  }
+  Room* allocRoom(uint8_t f, uint8_t r) { return &slots[f][r]; }
 };
-struct ProtocolModel {
-  uint8_t   systemState = DISARMED; // s/st
-  uint8_t   keypad      = NO_INPUT; // s/ke
-  uint8_t   network     = 0;        // n/st
-  String    mac         = "";       // n/mc
-  FloorNode floors[SMP_MAX_FLOORS]; // f/{f}
+
+// Up to N rooms in a sorted array keyed by f*R + r: O(log N) lookup,
+// N*sizeof(Room) bytes however large F and R are.
+template <uint8_t F, uint8_t R, uint8_t S, uint16_t N>
+struct SparseModel : ModelBaseT<F, R, S> {
+  typedef RoomNodeT<S> Room;
+  uint16_t count = 0;
+  uint16_t keys[N] = {};
+  Room     slots[N];
+
+  Room* room(uint8_t f, uint8_t r) {
+    uint16_t i = lowerBound(key(f, r));
+    return (i < count && keys[i] == key(f, r)) ? &slots[i] : nullptr;
+  }
+  Room* allocRoom(uint8_t f, uint8_t r) {
+    uint16_t k = key(f, r), i = lowerBound(k);
+    if (i < count && keys[i] == k) return &slots[i];
+    if (count == N) return nullptr;
+    for (uint16_t j = count; j > i; j--){ keys[j] = keys[j-1]; slots[j] = slots[j-1]; }
+    keys[i] = k; slots[i] = Room(); count++;
+    return &slots[i];
+  }
+
+private:
+  static uint16_t key(uint8_t f, uint8_t r){ return (uint16_t)(f * R + r); }
+  uint16_t lowerBound(uint16_t k) const {
+    uint16_t lo = 0, hi = count;
+    while (lo < hi){ uint16_t mid = (lo + hi) / 2; if (keys[mid] < k) lo = mid + 1; else hi = mid; }
+    return lo;
+  }
 };
 
+#if SMP_SPARSE_ROOMS > 0
+typedef SparseModel<SMP_MAX_FLOORS, SMP_MAX_ROOMS, SMP_MAX_SENSORS, SMP_SPARSE_ROOMS> ProtocolModel;
+#else
+typedef DenseModel<SMP_MAX_FLOORS, SMP_MAX_ROOMS, SMP_MAX_SENSORS> ProtocolModel;
+#endif
+typedef ProtocolModel::Room  RoomNode;
+typedef ProtocolModel::Floor FloorNode;
+
 // -------- Global MODEL --------
 extern ProtocolModel MODEL;
 
@@ -55,53 +159,194 @@ bool addHall(uint8_t f_id, uint8_t r_id, uint8_t hs_id);
 bool setSystemState(uint8_t s);
 bool setKeypad(uint8_t k);
 bool setNetwork(uint8_t n);
-bool setMac(const String& mac);
+bool setMac(const String& mac);   // "AA:BB:CC:DD:EE:FF" ('-' also accepted)
 
 void resetModel();
 
+// -------- Tracked setters (mark the field dirty only when the value changes) --------
+bool setFloorConnected(uint8_t f_id, bool connected);
+bool setFloorTimestamp(uint8_t f_id, uint32_t ts);
+bool setRoomConnected (uint8_t f_id, uint8_t r_id, bool connected);
+bool setRoomTimestamp (uint8_t f_id, uint8_t r_id, uint32_t ts);
+bool setUltraValue    (uint8_t f_id, uint8_t r_id, uint8_t u_id, uint8_t value);
+bool setHallOpen      (uint8_t f_id, uint8_t r_id, uint8_t hs_id, bool open);
+
+bool isFloorDirty  (uint8_t f_id, uint8_t sink);
+bool isRoomDirty   (uint8_t f_id, uint8_t r_id, uint8_t sink);
+bool isRoomDataDirty(uint8_t f_id, uint8_t r_id, uint8_t sink);   // cs or a sensor, not just ts
+void clearFloorDirty(uint8_t f_id, uint8_t sink);
+void clearRoomDirty (uint8_t f_id, uint8_t r_id, uint8_t sink);
+
+// -------- Alarm events --------
+// Security-relevant transitions flagged by the setters, and so by every
+// parser: a hall sensor opening while systemState is ARMED. Held until the
+// node's fast path takes them; atUs = micros() at detection.
+#ifndef SMP_ALARM_QUEUE_LEN
+#define SMP_ALARM_QUEUE_LEN 4
+#endif
+struct AlarmEvent { uint8_t f, r, h; uint32_t atUs; };
+bool     takeAlarmEvent(AlarmEvent& ev);   // oldest first; false if none
+uint8_t  pendingAlarmEvents();
+uint32_t droppedAlarmEvents();             // lost because the queue was full
+
+// -------- Topic tokenizer (allocation-free) --------
+enum TopicKind : uint8_t {
+  TOPIC_NONE=0,
+  TOPIC_SYS_STATE,   // s/st
+  TOPIC_SYS_KEYPAD,  // s/ke
+  TOPIC_NET_STATE,   // n/st
+  TOPIC_NET_MAC,     // n/mc
+  TOPIC_FLOOR_CS,    // f/{f}/cs
+  TOPIC_FLOOR_TS,    // f/{f}/ts
+  TOPIC_ROOM_CS,     // f/{f}/r/{r}/cs
+  TOPIC_ROOM_TS,     // f/{f}/r/{r}/ts
+  TOPIC_ULTRA,       // f/{f}/r/{r}/u/{u}
+  TOPIC_HALL         // f/{f}/r/{r}/h/{h}
+};
+struct TopicRef {
+  uint8_t kind = TOPIC_NONE;
+  uint8_t f    = 0;
+  uint8_t r    = 0;
+  uint8_t id   = 0;  // u/{u} or h/{h}
+};
+
+// Walks topic[0..len) in place (no String, no heap). With cloud=true the
+// "ELEC520/security/" prefix is required. IDs are range-checked by the adders.
+bool parseTopic(const char* topic, size_t len, bool cloud, TopicRef& out);
+// Applies payload[0..len) to MODEL for an already tokenized topic.
+bool applyTopic(const TopicRef& t, const char* payload, size_t len);
+
 // -------- Parsers --------
 bool parseNode (const char* topic, const char* rawPayload);
 bool parseCloud(const char* topic, const char* rawPayload);
+// Length-delimited payload, e.g. MqttCallBack's (topic, payload, length).
+bool parseCloud(const char* topic, const uint8_t* payload, unsigned int length);
 
 // Convenience parser for single "topic:value" strings, e.g. "f/1/r/1/h/1:1"
 bool parseTokenLine(const String& tokenLine);
 
-// -------- Topic builders (Node, no prefix) --------
-String nodeTopicSystemState();                               // s/st
-String nodeTopicKeypad();                                    // s/ke
-String nodeTopicNetwork();                                   // n/st
-String nodeTopicMac();                                       // n/mc
-String nodeTopicFloorConnection(uint8_t f_id);               // f/{f}/cs
-String nodeTopicRoomConnection(uint8_t f_id,uint8_t r_id);   // f/{f}/r/{r}/cs
-String nodeTopicUltra(uint8_t f_id,uint8_t r_id,uint8_t u_id);   // f/{f}/r/{r}/u/{u}
-String nodeTopicHall(uint8_t f_id,uint8_t r_id,uint8_t hs_id);   // f/{f}/r/{r}/h/{h}
-String nodeTopicFloorTimestamp(uint8_t f_id);                // f/{f}/ts
-String nodeTopicRoomTimestamp(uint8_t f_id,uint8_t r_id);    // f/{f}/r/{r}/ts
-
-// -------- Topic builders (Cloud, with prefix) --------
-String cloudTopicFloor(uint8_t f_id);                        // ELEC520/security/f/{f}
-String cloudTopicSystemState();                              // ELEC520/security/s/st
-String cloudTopicKeypad();                                   // ELEC520/security/s/ke
-String cloudTopicNetwork();                                  // ELEC520/security/n/st
-String cloudTopicMac();                                      // ELEC520/security/n/mc
-String cloudTopicFloorConnection(uint8_t f_id);              // ELEC520/security/f/{f}/cs
-String cloudTopicRoomConnection(uint8_t f_id,uint8_t r_id);  // ELEC520/security/f/{f}/r/{r}/cs
-String cloudTopicUltra(uint8_t f_id,uint8_t r_id,uint8_t u_id); // ELEC520/security/f/{f}/r/{r}/u/{u}
-String cloudTopicHall(uint8_t f_id,uint8_t r_id,uint8_t hs_id); // ELEC520/security/f/{f}/r/{r}/h/{h}
-String cloudTopicFloorTimestamp(uint8_t f_id);               // ELEC520/security/f/{f}/ts
-String cloudTopicRoomTimestamp(uint8_t f_id,uint8_t r_id);   // ELEC520/security/f/{f}/r/{r}/ts
+// -------- Topic builders --------
+#ifndef SMP_TOPIC_RING
+#define SMP_TOPIC_RING 4
+#endif
+// O(1) lookups into compile-time tables held in flash; no heap. Node topics
+// are the cloud topics without the "ELEC520/security/" prefix, so both share
+// one table. Out-of-range IDs return "". The u/h tables hold
+// SMP_MAX_FLOORS*SMP_MAX_ROOMS*SMP_MAX_SENSORS entries each.
+// Cost at 8x8x8 (29-byte entries): u/h 14.8 KB each, room cs/ts 1.9 KB each,
+// floor/cs/ts 232 B each, ~34 KB in all. Each table is only linked if its
+// builder is called (the ESP32 core links with --gc-sections): system_node
+// publishes whole floors and only pulls in the 232 B floor table; the u/h
+// tables cost flash only in sketches that publish single sensors.
+// With SMP_SPARSE_ROOMS there are no room or u/h tables: those topics are
+// formatted on demand into a ring of SMP_TOPIC_RING static buffers, so each
+// result is only valid for that many further room/sensor topic calls.
+
+// Node (no prefix)
+const char* nodeTopicSystemState();                               // s/st
+const char* nodeTopicKeypad();                                    // s/ke
+const char* nodeTopicNetwork();                                   // n/st
+const char* nodeTopicMac();                                       // n/mc
+const char* nodeTopicFloorConnection(uint8_t f_id);               // f/{f}/cs
+const char* nodeTopicRoomConnection(uint8_t f_id,uint8_t r_id);   // f/{f}/r/{r}/cs
+const char* nodeTopicUltra(uint8_t f_id,uint8_t r_id,uint8_t u_id);   // f/{f}/r/{r}/u/{u}
+const char* nodeTopicHall(uint8_t f_id,uint8_t r_id,uint8_t hs_id);   // f/{f}/r/{r}/h/{h}
+const char* nodeTopicFloorTimestamp(uint8_t f_id);                // f/{f}/ts
+const char* nodeTopicRoomTimestamp(uint8_t f_id,uint8_t r_id);    // f/{f}/r/{r}/ts
+
+// Cloud (with prefix)
+const char* cloudTopicFloor(uint8_t f_id);                        // ELEC520/security/f/{f}
+const char* cloudTopicSystem();                                   // ELEC520/security/system ("topic:value;..." list)
+const char* cloudTopicSystemState();                              // ELEC520/security/s/st
+const char* cloudTopicKeypad();                                   // ELEC520/security/s/ke
+const char* cloudTopicNetwork();                                  // ELEC520/security/n/st
+const char* cloudTopicMac();                                      // ELEC520/security/n/mc
+const char* cloudTopicFloorConnection(uint8_t f_id);              // ELEC520/security/f/{f}/cs
+const char* cloudTopicRoomConnection(uint8_t f_id,uint8_t r_id);  // ELEC520/security/f/{f}/r/{r}/cs
+const char* cloudTopicUltra(uint8_t f_id,uint8_t r_id,uint8_t u_id); // ELEC520/security/f/{f}/r/{r}/u/{u}
+const char* cloudTopicHall(uint8_t f_id,uint8_t r_id,uint8_t hs_id); // ELEC520/security/f/{f}/r/{r}/h/{h}
+const char* cloudTopicFloorTimestamp(uint8_t f_id);               // ELEC520/security/f/{f}/ts
+const char* cloudTopicRoomTimestamp(uint8_t f_id,uint8_t r_id);   // ELEC520/security/f/{f}/r/{r}/ts
 
 // -------- ESP-NOW per-room compact string --------
 String buildRoomEspString(uint8_t f_id, uint8_t r_id);
 bool   parseRoomEspString(const String& roomData);
 
+// -------- ESP-NOW per-room binary frame --------
+// [hdr][f][r][flags][hallUsed][hallOpen][ultraUsed][ultra values...]
+//  hdr       : 0xA0 | version (never printable, so it can't be mistaken for text)
+//  flags     : bit0 = room connected
+//  masks     : bit n = sensor n, SMP_SENSOR_MASK_BYTES each, little-endian
+//  ultra vals: one byte per set bit of ultraUsed, lowest bit first
+#define ROOM_FRAME_VERSION    1
+#define ROOM_FRAME_HDR        (0xA0 | ROOM_FRAME_VERSION)
+#define SMP_SENSOR_MASK_BYTES sizeof(SmpMask<SMP_MAX_SENSORS>)
+#define ROOM_FRAME_FIXED_LEN  (4 + 3 * SMP_SENSOR_MASK_BYTES)
+#define ROOM_FRAME_MAX_LEN    (ROOM_FRAME_FIXED_LEN + SMP_MAX_SENSORS)
+
+size_t buildRoomEspFrame(uint8_t f_id, uint8_t r_id, uint8_t* buf, size_t cap); // 0 on failure
+bool   isRoomEspFrame   (const uint8_t* data, size_t len);
+bool   parseRoomEspFrame(const uint8_t* data, size_t len);
+
+// -------- ESP-NOW multi-room batch frame --------
+// [hdr][count][room record]...   record = a room frame without its hdr byte
+//  hdr: 0xB0 | version
+// appendRoomToBatch() returns 0 when the room doesn't fit: send the frame,
+// beginRoomBatch() again and re-append. measureRoomRecord() tells the two
+// apart up front: 0 means the room isn't in the model (nothing to append).
+// Text equivalent: parseRoomEspString() strings joined with '\n'.
+#define ROOM_BATCH_VERSION    1
+#define ROOM_BATCH_HDR        (0xB0 | ROOM_BATCH_VERSION)
+#define ROOM_BATCH_FIXED_LEN  2
+
+size_t beginRoomBatch     (uint8_t* buf, size_t cap);                            // header length, 0 on failure
+size_t appendRoomToBatch  (uint8_t f_id, uint8_t r_id, uint8_t* buf, size_t len, size_t cap); // new length, 0 if it doesn't fit
+size_t measureRoomRecord  (uint8_t f_id, uint8_t r_id);                          // bytes the room adds, 0 if not in the model
+bool   isRoomBatchFrame   (const uint8_t* data, size_t len);
+bool   parseRoomBatchFrame(const uint8_t* data, size_t len);
+bool   parseRoomEspText   (const char* data, size_t len);                        // one or more '\n'-separated rooms
+
+// -------- Delta strings (changed fields only; clear the sink's flags) --------
+// Room : "f/{f}/r/{r}[/cs:v][;u/{u}:v][;h/{h}:v]"   (parseRoomEspString compatible)
+// Floor: "[cs:v][;ts:v][;r/{r}/cs:v]..."              (buildFloorMqttString tokens)
+// Both return an empty String when nothing changed for that sink. The room
+// string has no ts field, so a room whose only change is ts also returns ""
+// (and the change is cleared).
+String buildRoomDeltaString (uint8_t f_id, uint8_t r_id, uint8_t sink = SINK_ESP);
+String buildFloorDeltaString(uint8_t f_id, uint8_t sink = SINK_MQTT);
+
 // -------- MQTT full-system compact string --------
+// Carried on cloudTopicSystem(). A populated model's list is far bigger than
+// an MQTT client buffer, so it goes as several messages on that topic, each
+// split at a ';' (writeSystemMqttChunked()); every message parses on its own.
 String buildSystemMqttString();
 bool   parseSystemMqttString(const String& systemData);
+// Cursor-based, O(1) memory; takes MqttCallBack's (payload, length) directly.
+bool   parseSystemMqtt(const char* data, size_t len);
+bool   parseSystemMqtt(const uint8_t* payload, unsigned int length);
 
 // -------- MQTT per-floor compact string (payload for ELEC520/security/f/{f}) --------
 String buildFloorMqttString(uint8_t f_id);
 
+// -------- Streaming serializers (no intermediate Strings) --------
+// Write the same payloads as the builders above to any Print and return the
+// byte count. measure*() runs the writer against a counter, e.g. for the
+// plength argument of PubSubClient::beginPublish:
+//   client.beginPublish(topic, measureFloorMqtt(f), false);
+//   writeFloorMqtt(client, f);
+//   client.endPublish();
+size_t writeSystemMqtt    (Print& out);
+size_t writeFloorMqtt     (Print& out, uint8_t f_id);
+size_t writeFloorDeltaMqtt(Print& out, uint8_t f_id, uint8_t sink); // does not clear flags
+size_t measureSystemMqtt    ();
+size_t measureFloorMqtt     (uint8_t f_id);
+size_t measureFloorDeltaMqtt(uint8_t f_id, uint8_t sink);
+// The system list as messages of at most cap bytes (whole tokens, buf holds
+// cap bytes), each passed to emit(). Returns the number of messages, 0 if a
+// single token is longer than cap or emit() returned false.
+typedef bool (*SmpChunkFn)(const char* data, size_t len, void* ctx);
+size_t writeSystemMqttChunked(char* buf, size_t cap, SmpChunkFn emit, void* ctx);
+
 
 // ----- Debug helpers -----
 // Pretty, multi-line dump of the entire MODEL to any Arduino Stream (e.g., Serial)
@@ -0,0 +1,34 @@
+// Host benchmark for the topic parsers alone: parseNode / parseCloud
+// throughput and shim-heap allocations per call.
+// Uses only the API the library has had from the start, so it also builds
+// against older revisions (PROTO_DIR=...) for before/after comparisons.
+#include "elec520_protocol.h"
+#include "ShimHeap.h"
+#include <stdio.h>
+#include <chrono>
+
+static volatile size_t sink;   // keeps results alive under -O2
+
+int main(int argc, char** argv) {
+    long n = 2000000L * ((argc > 1 && atol(argv[1]) > 0) ? atol(argv[1]) : 1);
+
+    static const char* nodeTopics[] = {
+        "f/1/r/2/u/3", "f/1/r/2/h/1", "f/2/cs", "s/st", "f/3/r/4/ts"
+    };
+    static const char* cloudTopics[] = {
+        "ELEC520/security/f/1/r/2/u/3", "ELEC520/security/f/1/r/2/h/1",
+        "ELEC520/security/f/2/cs",      "ELEC520/security/s/st"
+    };
+
+    printf("%-12s %9s %14s %10s %10s\n", "operation", "iters", "parses/s", "ns/op", "allocs/op");
+    for (int pass = 0; pass < 2; pass++) {
+        size_t a0 = shimHeap.allocs;
+        auto t0 = std::chrono::steady_clock::now();
+        for (long i = 0; i < n; i++)
+            sink = pass ? parseCloud(cloudTopics[i & 3], "1") : parseNode(nodeTopics[i % 5], "1");
+        double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        printf("%-12s %9ld %14.0f %10.1f %10.2f\n", pass ? "parseCloud" : "parseNode",
+               n, n / s, s * 1e9 / n, (double)(shimHeap.allocs - a0) / n);
+    }
+    return 0;
+}
@@ -0,0 +1,135 @@
+// Host benchmark for elec520_protocol.
+// Reports ns/op, shim-heap allocations per op and peak heap per operation,
+// against a fully populated SMP_MAX_FLOORS x SMP_MAX_ROOMS x SMP_MAX_SENSORS model.
+#include "elec520_protocol.h"
+#include "ShimHeap.h"
+#include <stdio.h>
+#include <chrono>
+
+static volatile size_t sink;   // keeps results alive under -O2
+
+struct BenchResult {
+    double ns;
+    double allocs;
+    size_t peak;
+};
+
+template <typename Fn>
+static BenchResult run(long iters, Fn fn) {
+    for (long i = 0; i < iters / 10 + 1; i++) fn(i);   // warm-up
+
+    size_t a0 = shimHeap.allocs;
+    shimHeapResetPeak();
+    size_t live0 = shimHeap.liveBytes;
+
+    auto t0 = std::chrono::steady_clock::now();
+    for (long i = 0; i < iters; i++) fn(i);
+    double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    BenchResult r;
+    r.ns     = s * 1e9 / iters;
+    r.allocs = (double)(shimHeap.allocs - a0) / iters;
+    r.peak   = shimHeap.peakBytes - live0;
+    return r;
+}
+
+static void report(const char* name, long iters, const BenchResult& r) {
+    printf("%-28s %9ld %12.1f %12.2f %12zu\n", name, iters, r.ns, r.allocs, r.peak);
+}
+
+// Room / floor the single-room and single-floor operations use. Must be
+// populated: a sparse model runs out of rooms before the grid is full.
+static uint8_t benchF = 3, benchR = 4;
+static unsigned populatedRooms = 0;
+
+// Every floor, room and sensor, floor-major, until the model is out of rooms.
+static void populateFull() {
+    resetModel();
+    setSystemState(ARMED);
+    setKeypad(NO_INPUT);
+    setNetwork(1);
+    setMac("AA:BB:CC:DD:EE:FF");
+    populatedRooms = 0;
+    for (uint8_t f = 0; f < SMP_MAX_FLOORS; f++) {
+        setFloorConnected(f, true);
+        setFloorTimestamp(f, 1698312345UL + f);
+        for (uint8_t r = 0; r < SMP_MAX_ROOMS; r++) {
+            if (!addRoom(f, r)) goto full;
+            populatedRooms++;
+            setRoomConnected(f, r, true);
+            setRoomTimestamp(f, r, 1698312390UL + r);
+            for (uint8_t s = 0; s < SMP_MAX_SENSORS; s++) {
+                setUltraValue(f, r, s, (uint8_t)(f * 31 + r * 7 + s));
+                setHallOpen(f, r, s, ((f + r + s) & 1) != 0);
+            }
+        }
+    }
+full:
+    // Default room not allocated: use the last room of the fullest floor
+    if (!MODEL.room(benchF, benchR) && populatedRooms) {
+        benchF = (uint8_t)((populatedRooms - 1) / SMP_MAX_ROOMS);
+        benchR = (uint8_t)((populatedRooms - 1) % SMP_MAX_ROOMS);
+        if (benchF > 0 && benchR < SMP_MAX_ROOMS - 1) { benchF--; benchR = SMP_MAX_ROOMS - 1; }
+    }
+    if (!MODEL.room(benchF, benchR)) {
+        fprintf(stderr, "populateFull: no room to benchmark (%u rooms allocated)\n", populatedRooms);
+        exit(1);
+    }
+}
+
+int main(int argc, char** argv) {
+    long scale = (argc > 1) ? atol(argv[1]) : 1;
+    if (scale < 1) scale = 1;
+
+    static const char* nodeTopics[] = {
+        "f/1/r/2/u/3", "f/1/r/2/h/1", "f/2/cs", "s/st", "f/3/r/4/ts", "f/7/r/7/h/7"
+    };
+    static const char* cloudTopics[] = {
+        "ELEC520/security/f/1/r/2/u/3", "ELEC520/security/f/1/r/2/h/1",
+        "ELEC520/security/f/2/cs",      "ELEC520/security/s/st"
+    };
+
+    populateFull();
+    String room   = buildRoomEspString(benchF, benchR);
+    String system = buildSystemMqttString();
+    String floor  = buildFloorMqttString(benchF);
+
+    printf("elec520_protocol host benchmark (%dx%dx%d model)\n",
+           SMP_MAX_FLOORS, SMP_MAX_ROOMS, SMP_MAX_SENSORS);
+    printf("  sizeof(ProtocolModel) = %zu bytes (%s)\n", sizeof(ProtocolModel),
+           SMP_SPARSE_ROOMS > 0 ? "sparse" : "dense");
+    printf("  %u of %u rooms populated%s\n", populatedRooms, SMP_MAX_FLOORS * SMP_MAX_ROOMS,
+           populatedRooms < SMP_MAX_FLOORS * SMP_MAX_ROOMS ? " (model full)" : "");
+    printf("  system payload = %u bytes, floor %u payload = %u bytes, room %u/%u payload = %u bytes\n\n",
+           system.length(), benchF, floor.length(), benchF, benchR, room.length());
+    printf("%-28s %9s %12s %12s %12s\n", "operation", "iters", "ns/op", "allocs/op", "peak heap B");
+
+    long n = 200000 * scale;
+    report("parseNode", n, run(n, [&](long i) {
+        sink = parseNode(nodeTopics[i % 6], "1");
+    }));
+    report("parseCloud", n, run(n, [&](long i) {
+        sink = parseCloud(cloudTopics[i & 3], "1");
+    }));
+    report("parseRoomEspString", n / 4, run(n / 4, [&](long) {
+        sink = parseRoomEspString(room);
+    }));
+
+    long m = 200 * scale;
+    report("parseSystemMqttString", m, run(m, [&](long) {
+        sink = parseSystemMqttString(system);
+    }));
+    report("buildSystemMqttString", m, run(m, [&](long) {
+        sink = buildSystemMqttString().length();
+    }));
+    report("buildFloorMqttString", m * 8, run(m * 8, [&](long i) {
+        sink = buildFloorMqttString((uint8_t)(i % SMP_MAX_FLOORS)).length();
+    }));
+
+    // Informational: does the full system string survive parse -> build?
+    resetModel();
+    parseSystemMqttString(system);
+    printf("\nsystem string round-trip: %s\n",
+           buildSystemMqttString() == system ? "ok" : "MISMATCH");
+    return 0;
+}
@@ -0,0 +1,41 @@
+#include "Arduino.h"
+#include <chrono>
+#include <stdarg.h>
+#include <stdio.h>
+
+static const auto shimEpoch = std::chrono::steady_clock::now();
+
+uint32_t millis(void) {
+    return (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - shimEpoch).count();
+}
+
+uint32_t micros(void) {
+    return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - shimEpoch).count();
+}
+
+uint8_t shimPinLevel[SHIM_NUM_PINS];
+HardwareSerial Serial;
+
+void pinMode(uint8_t pin, uint8_t mode) {
+    if (pin < SHIM_NUM_PINS && mode == INPUT_PULLUP) shimPinLevel[pin] = HIGH;
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+    if (pin < SHIM_NUM_PINS) shimPinLevel[pin] = val ? HIGH : LOW;
+}
+
+int digitalRead(uint8_t pin) {
+    return pin < SHIM_NUM_PINS ? shimPinLevel[pin] : LOW;
+}
+
+int HardwareSerial::printf(const char* fmt, ...) {
+    char buf[256];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if (n > 0) write((const uint8_t*)buf, strlen(buf));
+    return n;
+}
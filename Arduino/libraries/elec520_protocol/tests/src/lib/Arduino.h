@@ -0,0 +1,53 @@
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "WString.h"
+#include "Print.h"
+#include "Stream.h"
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+uint32_t millis(void);
+uint32_t micros(void);
+
+#define PROGMEM
+#define pgm_read_byte_near(x) *(x)
+#define F(s) (s)
+
+#define LOW          0
+#define HIGH         1
+#define INPUT        0
+#define OUTPUT       1
+#define INPUT_PULLUP 2
+
+// GPIO: digitalRead() returns shimPinLevel[pin], which the checks drive;
+// pinMode(INPUT_PULLUP) and digitalWrite() set it as the pin would.
+#define SHIM_NUM_PINS 40
+extern uint8_t shimPinLevel[SHIM_NUM_PINS];
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int  digitalRead(uint8_t pin);
+
+// Serial keeps what is printed in memory, like any other shim Stream.
+class HardwareSerial : public Stream {
+public:
+    void begin(unsigned long) {}
+    int printf(const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+};
+extern HardwareSerial Serial;
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+#ifndef min
+template <typename A, typename B> static inline A min(A a, B b){ return (b < a) ? (A)b : a; }
+#endif
+#ifndef max
+template <typename A, typename B> static inline A max(A a, B b){ return (a < b) ? (A)b : a; }
+#endif
+
+#endif // Arduino_h
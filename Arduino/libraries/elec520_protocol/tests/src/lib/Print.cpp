@@ -0,0 +1,23 @@
+#include "Print.h"
+
+// Same digit loop as the Arduino core's Print::printNumber.
+size_t Print::print(unsigned long v, int base) {
+    char buf[8 * sizeof(long) + 1];
+    char* p = &buf[sizeof(buf) - 1];
+    *p = '\0';
+    if (base < 2) base = DEC;
+    do {
+        char d = (char)(v % base);
+        v /= base;
+        *--p = d < 10 ? d + '0' : d + 'A' - 10;
+    } while (v);
+    return write(p);
+}
+
+size_t Print::print(long v, int base) {
+    if (base == DEC && v < 0) {
+        size_t n = write((uint8_t)'-');
+        return n + print((unsigned long)(-v), DEC);
+    }
+    return print((unsigned long)v, base);
+}
@@ -0,0 +1,37 @@
+#ifndef Print_h
+#define Print_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "WString.h"
+
+#define DEC 10
+#define HEX 16
+
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t) = 0;
+    virtual size_t write(const uint8_t* buf, size_t n) {
+        size_t w = 0;
+        while (n--) w += write(*buf++);
+        return w;
+    }
+    size_t write(const char* s) { return s ? write((const uint8_t*)s, strlen(s)) : 0; }
+    virtual void flush() {}
+
+    size_t print(const char* s)   { return write(s); }
+    size_t print(const String& s) { return write((const uint8_t*)s.c_str(), s.length()); }
+    size_t print(char c)          { return write((uint8_t)c); }
+    size_t print(unsigned long v, int base = DEC);
+    size_t print(long v, int base = DEC);
+    size_t print(unsigned int v, int base = DEC)  { return print((unsigned long)v, base); }
+    size_t print(int v, int base = DEC)           { return print((long)v, base); }
+    size_t print(unsigned char v, int base = DEC) { return print((unsigned long)v, base); }
+
+    size_t println()                   { return write("\r\n"); }
+    template <typename T> size_t println(const T& v) { size_t n = print(v); return n + println(); }
+};
+
+#endif
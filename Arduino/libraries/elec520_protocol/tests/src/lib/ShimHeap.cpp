@@ -0,0 +1,30 @@
+#include "ShimHeap.h"
+#include <stdlib.h>
+#include <string.h>
+
+ShimHeapStats shimHeap = {0, 0, 0, 0};
+
+// Each block carries its size in a small header so frees can be accounted.
+struct BlockHeader { size_t size; size_t pad; };
+
+void* shimRealloc(void* p, size_t n) {
+    BlockHeader* old = p ? ((BlockHeader*)p) - 1 : nullptr;
+    size_t oldSize = old ? old->size : 0;
+    BlockHeader* h = (BlockHeader*)realloc(old, sizeof(BlockHeader) + n);
+    if (!h) return nullptr;
+    h->size = n;
+    shimHeap.allocs++;
+    shimHeap.liveBytes += n - oldSize;
+    if (shimHeap.liveBytes > shimHeap.peakBytes) shimHeap.peakBytes = shimHeap.liveBytes;
+    return h + 1;
+}
+
+void shimFree(void* p) {
+    if (!p) return;
+    BlockHeader* h = ((BlockHeader*)p) - 1;
+    shimHeap.frees++;
+    shimHeap.liveBytes -= h->size;
+    free(h);
+}
+
+void shimHeapResetPeak() { shimHeap.peakBytes = shimHeap.liveBytes; }
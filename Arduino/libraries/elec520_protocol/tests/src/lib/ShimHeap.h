@@ -0,0 +1,21 @@
+#ifndef ShimHeap_h
+#define ShimHeap_h
+
+#include <stddef.h>
+
+// Counting allocator behind the shim String. The benchmark snapshots these
+// around each operation to report allocations per op and peak heap.
+struct ShimHeapStats {
+    size_t allocs;      // malloc + growing realloc calls
+    size_t frees;
+    size_t liveBytes;
+    size_t peakBytes;
+};
+
+extern ShimHeapStats shimHeap;
+
+void* shimRealloc(void* p, size_t n);
+void  shimFree(void* p);
+void  shimHeapResetPeak();
+
+#endif
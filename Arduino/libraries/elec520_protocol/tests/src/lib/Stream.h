@@ -0,0 +1,17 @@
+#ifndef Stream_h
+#define Stream_h
+
+#include "Print.h"
+
+// Output-only Stream: everything written is appended to an in-memory buffer.
+class Stream : public Print {
+public:
+    virtual size_t write(uint8_t b) { _out += (char)b; return 1; }
+    using Print::write;
+    const String& output() const { return _out; }
+    void clear() { _out = String(); }
+private:
+    String _out;
+};
+
+#endif
@@ -0,0 +1,128 @@
+#include "WString.h"
+#include "ShimHeap.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+String::String(const char* s) : _buf(nullptr), _len(0), _cap(0) { *this = s; }
+String::String(const String& s) : _buf(nullptr), _len(0), _cap(0) { *this = s; }
+String::String(String&& s) : _buf(nullptr), _len(0), _cap(0) { move(s); }
+String::String(char c) : _buf(nullptr), _len(0), _cap(0) { concat(&c, 1); }
+
+static void fmtUnsigned(char* out, unsigned long v, unsigned char base) {
+    snprintf(out, 24, base == 16 ? "%lx" : "%lu", v);
+}
+
+String::String(unsigned char v, unsigned char base) : _buf(nullptr), _len(0), _cap(0) {
+    char b[24]; fmtUnsigned(b, v, base); *this = b;
+}
+String::String(unsigned int v, unsigned char base) : _buf(nullptr), _len(0), _cap(0) {
+    char b[24]; fmtUnsigned(b, v, base); *this = b;
+}
+String::String(unsigned long v, unsigned char base) : _buf(nullptr), _len(0), _cap(0) {
+    char b[24]; fmtUnsigned(b, v, base); *this = b;
+}
+String::String(int v, unsigned char base) : _buf(nullptr), _len(0), _cap(0) {
+    char b[24]; snprintf(b, sizeof(b), base == 16 ? "%x" : "%d", v); *this = b;
+}
+String::String(long v, unsigned char base) : _buf(nullptr), _len(0), _cap(0) {
+    char b[24]; snprintf(b, sizeof(b), base == 16 ? "%lx" : "%ld", v); *this = b;
+}
+
+String::~String() { shimFree(_buf); }
+
+void String::move(String& s) {
+    shimFree(_buf);
+    _buf = s._buf; _len = s._len; _cap = s._cap;
+    s._buf = nullptr; s._len = 0; s._cap = 0;
+}
+
+String& String::operator=(const String& s) {
+    if (this == &s) return *this;
+    _len = 0;
+    if (_buf) _buf[0] = '\0';
+    concat(s.c_str(), s._len);
+    return *this;
+}
+String& String::operator=(String&& s) { if (this != &s) move(s); return *this; }
+String& String::operator=(const char* s) {
+    _len = 0;
+    if (_buf) _buf[0] = '\0';
+    if (s) concat(s, strlen(s));
+    return *this;
+}
+
+bool String::reserve(unsigned int size) {
+    if (_buf && _cap >= size) return true;
+    char* nb = (char*)shimRealloc(_buf, size + 1);
+    if (!nb) return false;
+    if (!_buf) nb[0] = '\0';
+    _buf = nb; _cap = size;
+    return true;
+}
+
+bool String::concat(const char* s, unsigned int n) {
+    if (n == 0) return true;
+    if (!reserve(_len + n)) return false;
+    memmove(_buf + _len, s, n);
+    _len += n;
+    _buf[_len] = '\0';
+    return true;
+}
+
+String operator+(const String& a, const String& b) { String r(a); r += b; return r; }
+String operator+(const String& a, const char* b)   { String r(a); r += b; return r; }
+String operator+(const char* a, const String& b)   { String r(a); r += b; return r; }
+
+bool String::startsWith(const String& p) const {
+    return p._len <= _len && memcmp(c_str(), p.c_str(), p._len) == 0;
+}
+
+int String::indexOf(char c, unsigned int from) const {
+    if (from >= _len) return -1;
+    const char* hit = (const char*)memchr(_buf + from, c, _len - from);
+    return hit ? (int)(hit - _buf) : -1;
+}
+
+int String::indexOf(const String& s, unsigned int from) const {
+    if (from >= _len) return -1;
+    const char* hit = strstr(_buf + from, s.c_str());
+    return hit ? (int)(hit - _buf) : -1;
+}
+
+String String::substring(unsigned int from, unsigned int to) const {
+    if (from > to) { unsigned int t = from; from = to; to = t; }
+    String out;
+    if (from >= _len) return out;
+    if (to > _len) to = _len;
+    out.concat(_buf + from, to - from);
+    return out;
+}
+
+void String::remove(unsigned int index, unsigned int count) {
+    if (index >= _len) return;
+    if (count > _len - index) count = _len - index;
+    memmove(_buf + index, _buf + index + count, _len - index - count + 1);
+    _len -= count;
+}
+
+void String::trim() {
+    if (!_buf || _len == 0) return;
+    unsigned int b = 0, e = _len;
+    while (b < e && isspace((unsigned char)_buf[b])) b++;
+    while (e > b && isspace((unsigned char)_buf[e - 1])) e--;
+    _len = e - b;
+    if (b) memmove(_buf, _buf + b, _len);
+    _buf[_len] = '\0';
+}
+
+long String::toInt() const { return _buf ? atol(_buf) : 0; }
+
+void String::toCharArray(char* buf, unsigned int size, unsigned int index) const {
+    if (!size || !buf) return;
+    if (index >= _len) { buf[0] = 0; return; }
+    unsigned int n = _len - index;
+    if (n > size - 1) n = size - 1;
+    memcpy(buf, _buf + index, n);
+    buf[n] = 0;
+}
@@ -0,0 +1,69 @@
+#ifndef WString_h
+#define WString_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+// Host stand-in for the Arduino core String. Storage comes from the shim heap
+// (see ShimHeap.h) so the benchmark can count allocations the same way the
+// ESP32 heap would see them.
+class String {
+public:
+    String(const char* s = "");
+    String(const String& s);
+    String(String&& s);
+    explicit String(char c);
+    explicit String(unsigned char v, unsigned char base = 10);
+    explicit String(int v, unsigned char base = 10);
+    explicit String(unsigned int v, unsigned char base = 10);
+    explicit String(long v, unsigned char base = 10);
+    explicit String(unsigned long v, unsigned char base = 10);
+    ~String();
+
+    String& operator=(const String& s);
+    String& operator=(String&& s);
+    String& operator=(const char* s);
+
+    bool reserve(unsigned int size);
+    unsigned int length() const { return _len; }
+    const char* c_str() const { return _buf ? _buf : ""; }
+
+    bool concat(const char* s, unsigned int n);
+    String& operator+=(const String& s) { concat(s.c_str(), s._len); return *this; }
+    String& operator+=(const char* s)   { if (s) concat(s, strlen(s)); return *this; }
+    String& operator+=(char c)          { concat(&c, 1); return *this; }
+    String& operator+=(unsigned char v) { return *this += String(v); }
+    String& operator+=(int v)           { return *this += String(v); }
+    String& operator+=(unsigned int v)  { return *this += String(v); }
+    String& operator+=(long v)          { return *this += String(v); }
+    String& operator+=(unsigned long v) { return *this += String(v); }
+
+    friend String operator+(const String& a, const String& b);
+    friend String operator+(const String& a, const char* b);
+    friend String operator+(const char* a, const String& b);
+
+    bool operator==(const String& s) const { return _len == s._len && memcmp(c_str(), s.c_str(), _len) == 0; }
+    bool operator==(const char* s) const   { return strcmp(c_str(), s ? s : "") == 0; }
+    bool operator!=(const String& s) const { return !(*this == s); }
+    bool operator!=(const char* s) const   { return !(*this == s); }
+    char operator[](unsigned int i) const  { return i < _len ? _buf[i] : 0; }
+
+    bool startsWith(const String& prefix) const;
+    int indexOf(char c, unsigned int from = 0) const;
+    int indexOf(const String& s, unsigned int from = 0) const;
+    String substring(unsigned int from) const { return substring(from, _len); }
+    String substring(unsigned int from, unsigned int to) const;
+    void remove(unsigned int index, unsigned int count);
+    void trim();
+    long toInt() const;
+    void toCharArray(char* buf, unsigned int size, unsigned int index = 0) const;
+
+private:
+    char*        _buf;
+    unsigned int _len;
+    unsigned int _cap;
+    void move(String& s);
+};
+
+#endif
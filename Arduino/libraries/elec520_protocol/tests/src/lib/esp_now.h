@@ -0,0 +1,7 @@
+#ifndef esp_now_h
+#define esp_now_h
+
+// Only what the system_node headers under test need.
+#define ESP_NOW_MAX_DATA_LEN 250
+
+#endif // esp_now_h
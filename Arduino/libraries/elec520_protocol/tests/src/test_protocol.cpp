@@ -0,0 +1,638 @@
+// Host behaviour checks for elec520_protocol and the wire formats around it.
+// Every check prints on failure; the exit status is non-zero if any failed,
+// so `make test` fails too.
+#include "elec520_protocol.h"
+#include "classEspTxQueue.h"      // system_node: sequenced ESP-NOW wrapper
+#include "classPeerTable.h"
+#include "classTdmaScheduler.h"     // system_node: floor transmit slots
+#include "classMqttPublisher.h"     // system_node: MQTT publish policy
+#include "classI2cBus.h"            // system_node: Nano discovery and polling order
+#include "elec520_i2c.h"          // Nano -> ESP32 I2C frame
+#include "elec520_filter.h"       // Nano ultrasonic filter
+#include <stdio.h>
+
+static int checks = 0, failures = 0;
+
+#define CHECK(cond) do { checks++; if (!(cond)) { failures++; \
+    printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); } } while (0)
+
+// ---------------- Room frame (0xA1) ----------------
+static void setupRoom() {
+    resetModel();
+    setRoomConnected(1, 2, true);
+    setUltraValue(1, 2, 0, 42);
+    setUltraValue(1, 2, 3, 200);
+    setHallOpen(1, 2, 1, true);
+    setHallOpen(1, 2, 2, false);
+}
+
+static void testRoomFrame() {
+    uint8_t buf[ROOM_FRAME_MAX_LEN], again[ROOM_FRAME_MAX_LEN];
+    setupRoom();
+    String text = buildRoomEspString(1, 2);
+    size_t n = buildRoomEspFrame(1, 2, buf, sizeof(buf));
+    CHECK(n == ROOM_FRAME_FIXED_LEN + 2);
+    CHECK(buf[0] == ROOM_FRAME_HDR);
+    CHECK(isRoomEspFrame(buf, n));
+    CHECK(buildRoomEspFrame(1, 2, buf, n - 1) == 0);       // doesn't fit
+
+    // Round trip: same room, same bytes
+    resetModel();
+    CHECK(parseRoomEspFrame(buf, n));
+    CHECK(buildRoomEspString(1, 2) == text);
+    CHECK(buildRoomEspFrame(1, 2, again, sizeof(again)) == n);
+    CHECK(memcmp(buf, again, n) == 0);
+
+    // Truncated anywhere, or with a trailing byte: rejected, model untouched
+    for (size_t len = 0; len < n; len++) {
+        resetModel();
+        CHECK(!parseRoomEspFrame(buf, len));
+        CHECK(MODEL.room(1, 2) == nullptr);
+    }
+    buf[n] = 0;
+    CHECK(!parseRoomEspFrame(buf, n + 1));
+
+    // Wrong header: other version, other frame type, text
+    const uint8_t hdrs[] = { 0xA0 | (ROOM_FRAME_VERSION + 1), ROOM_BATCH_HDR, 'f' };
+    for (uint8_t h : hdrs) {
+        resetModel();
+        buf[0] = h;
+        CHECK(!parseRoomEspFrame(buf, n));
+        CHECK(MODEL.room(1, 2) == nullptr);
+    }
+    CHECK(!parseRoomEspFrame(nullptr, n));
+}
+
+// ---------------- Batch frame (0xB1) ----------------
+static void testBatchFrame() {
+    uint8_t buf[2 * ROOM_FRAME_MAX_LEN + ROOM_BATCH_FIXED_LEN];
+    setupRoom();
+    setRoomConnected(1, 5, false);
+    setHallOpen(1, 5, 0, true);
+    String text = buildRoomEspString(1, 2) + "\n" + buildRoomEspString(1, 5);
+
+    size_t n = beginRoomBatch(buf, sizeof(buf));
+    CHECK(n == ROOM_BATCH_FIXED_LEN && buf[0] == ROOM_BATCH_HDR && buf[1] == 0);
+    size_t rec = measureRoomRecord(1, 2);
+    n = appendRoomToBatch(1, 2, buf, n, sizeof(buf));
+    size_t first = n;
+    CHECK(rec > 0 && first == ROOM_BATCH_FIXED_LEN + rec);
+
+    // Rooms not in the model measure 0 (and aren't added by asking)
+    CHECK(measureRoomRecord(1, 3) == 0 && MODEL.room(1, 3) == nullptr);
+    CHECK(measureRoomRecord(1, SMP_MAX_ROOMS) == 0);
+    CHECK(measureRoomRecord(SMP_MAX_FLOORS, 2) == 0);
+    n = appendRoomToBatch(1, 5, buf, n, sizeof(buf));
+    CHECK(first > ROOM_BATCH_FIXED_LEN && n > first);
+    CHECK(buf[1] == 2);
+    CHECK(isRoomBatchFrame(buf, n));
+    CHECK(appendRoomToBatch(1, 5, buf, n, n) == 0);          // full: caller flushes
+
+    // Round trip: both rooms back, same text
+    resetModel();
+    CHECK(parseRoomBatchFrame(buf, n));
+    CHECK(buildRoomEspString(1, 2) + "\n" + buildRoomEspString(1, 5) == text);
+
+    // Truncated anywhere or with a trailing byte: rejected
+    for (size_t len = 0; len < n; len++) CHECK(!parseRoomBatchFrame(buf, len));
+    buf[n] = 0;
+    CHECK(!parseRoomBatchFrame(buf, n + 1));
+
+    // Count that doesn't match the records
+    buf[1] = 3; CHECK(!parseRoomBatchFrame(buf, n));
+    buf[1] = 1; CHECK(!parseRoomBatchFrame(buf, n));
+    buf[1] = 2;
+
+    // Wrong header: other version, single-room frame
+    const uint8_t hdrs[] = { 0xB0 | (ROOM_BATCH_VERSION + 1), ROOM_FRAME_HDR };
+    for (uint8_t h : hdrs) {
+        resetModel();
+        buf[0] = h;
+        CHECK(!parseRoomBatchFrame(buf, n));
+        CHECK(MODEL.room(1, 2) == nullptr);
+    }
+
+    // Text equivalent
+    resetModel();
+    CHECK(parseRoomEspText(text.c_str(), text.length()));
+    CHECK(buildRoomEspString(1, 2) + "\n" + buildRoomEspString(1, 5) == text);
+}
+
+// ---------------- ESP-NOW send queue: backoff without head-of-line blocking ----------------
+static void testTxQueueBackoff() {
+    static classEspTxQueue<8> q;
+    const uint8_t a[6] = { 0xA }, b[6] = { 0xB };
+    uint8_t v;
+    for (v = 1; v <= 4; v++) q.push(v & 1 ? a : b, &v, 1);   // a1 b2 a3 b4
+
+    // a1 failed and backs off: b2 goes next, a3 waits behind a1
+    EspTxFrame* f = q.nextReady(1000);
+    CHECK(f == q.front() && f->data[0] == 1);
+    f->tries = 1;
+    f->retryAtMs = 1100;
+    f = q.nextReady(1000);
+    CHECK(f && f->data[0] == 2);
+    q.remove(f);
+    f = q.nextReady(1000);
+    CHECK(f && f->data[0] == 4);
+    q.remove(f);
+    CHECK(q.nextReady(1050) == nullptr && q.pending() == 2);
+
+    // Backoff over (also across a millis() wrap): a1 then a3, in order
+    f = q.nextReady(1100);
+    CHECK(f && f->data[0] == 1);
+    q.remove(f);
+    f = q.nextReady(1100);
+    CHECK(f && f->data[0] == 3 && f == q.front());
+    const unsigned long nearWrap = (unsigned long)0 - 16;
+    f->tries = 1;
+    f->retryAtMs = nearWrap + 26;        // due just after the wrap
+    CHECK(q.nextReady(nearWrap) == nullptr);
+    CHECK(q.nextReady(nearWrap + 30) == f);
+    q.remove(f);
+    CHECK(q.pending() == 0 && q.nextReady(0) == nullptr);
+
+    // Removing from the middle keeps the rest in order, across the ring edge
+    for (v = 10; v < 16; v++) q.push(a, &v, 1);
+    q.pop(); q.pop();
+    for (v = 16; v < 20; v++) q.push(b, &v, 1);     // 12..15 to a, 16..19 to b
+    q.remove(q.nextReady(0));                       // 12
+    q.front()->tries = 1;
+    q.front()->retryAtMs = 100;                     // 13 backs off
+    q.remove(q.nextReady(0));                       // 16
+    const uint8_t order[] = { 13, 14, 15, 17, 18, 19 };
+    bool inOrder = q.pending() == sizeof(order);
+    for (uint8_t want : order) {
+        f = q.front();
+        inOrder = inOrder && f && f->data[0] == want;
+        q.pop();
+    }
+    CHECK(inOrder);
+}
+
+// ---------------- Sequenced ESP-NOW wrapper (0xD1) ----------------
+static void testSeqWrapper() {
+    static classEspTxQueue<4> q;
+    const uint8_t dst[6] = { 1, 2, 3, 4, 5, 6 };
+    uint8_t payload[ESP_SEQ_PAYLOAD_MAX + 1];
+    for (size_t i = 0; i < sizeof(payload); i++) payload[i] = (uint8_t)(i * 7);
+
+    CHECK(q.pushSeq(dst, 200, payload, 10));
+    EspTxFrame* f = q.front();
+    CHECK(f && f->len == 10 + ESP_SEQ_LEN && f->data[0] == ESP_SEQ_HDR && f->data[1] == 200);
+    CHECK(!q.pushSeq(dst, 201, payload, ESP_SEQ_PAYLOAD_MAX + 1));   // too long with the header
+    CHECK(q.pushSeq(dst, 201, payload, ESP_SEQ_PAYLOAD_MAX));
+
+    // Round trip
+    const uint8_t* data = f->data;
+    size_t len = f->len;
+    uint8_t seq = 0;
+    CHECK(espSeqUnwrap(data, len, seq));
+    CHECK(seq == 200 && len == 10 && data == f->data + ESP_SEQ_LEN && memcmp(data, payload, 10) == 0);
+
+    // Not sequenced (beacon, bare frame, too short): left untouched
+    const uint8_t bare[] = { ROOM_FRAME_HDR, 1, 2 };
+    const uint8_t* d = bare;
+    len = sizeof(bare);
+    CHECK(!espSeqUnwrap(d, len, seq) && d == bare && len == sizeof(bare));
+    const uint8_t shortSeq[] = { ESP_SEQ_HDR };
+    d = shortSeq;
+    len = sizeof(shortSeq);
+    CHECK(!espSeqUnwrap(d, len, seq) && len == 1);
+
+    // Receiver side: duplicates dropped, gaps counted, reboots resync
+    EspPeer p = {};
+    CHECK(espPeerAcceptSeq(p, 10));
+    CHECK(!espPeerAcceptSeq(p, 10) && p.rxDup == 1);                // retry of a delivered frame
+    CHECK(espPeerAcceptSeq(p, 13) && p.rxLost == 2);                // 11, 12 missed
+    CHECK(espPeerAcceptSeq(p, 3) && p.rxLost == 2 && p.lastSeq == 3); // backwards: resync
+    p.lastSeq = 255;
+    CHECK(espPeerAcceptSeq(p, 0) && p.rxLost == 2);                 // wraps without loss
+}
+
+// ---------------- TDMA slots and beacons ----------------
+// unsigned long is wider on the host than on the ESP32, so "wrap" below means
+// the host's wrap; the modular maths is the same.
+static void testTdma() {
+    // Floor 2 of 3: slot 1, window [110, 190) of each 300 ms superframe
+    classTdmaScheduler t;
+    t.configure(3, 1, false);
+    t.setTiming(100, 10);
+    CHECK(t.getFrameMs() == 300 && t.getSlot() == 1 && !t.isSynced());
+    CHECK(!t.inTxWindow(109) && t.inTxWindow(110) && t.inTxWindow(189) && !t.inTxWindow(190));
+    CHECK(!t.inTxWindow(409) && t.inTxWindow(410) && !t.inTxWindow(490));
+
+    // Slot start reported once per superframe
+    CHECK(!t.slotStarted(700) && t.slotStarted(715) && !t.slotStarted(750) && !t.slotStarted(1000));
+    CHECK(t.slotStarted(1010));
+
+    // Guard clamped so the window is never empty; slot numbers wrap
+    classTdmaScheduler g;
+    g.configure(2, 3, false);               // slot 3 of 2 -> slot 1
+    g.setTiming(10, 8);                     // guard 4: window [14, 16)
+    CHECK(g.getSlot() == 1 && !g.inTxWindow(13) && g.inTxWindow(14) && g.inTxWindow(15) && !g.inTxWindow(16));
+
+    // Master: one beacon per superframe, stamped with the offset into it
+    classTdmaScheduler m;
+    m.configure(3, 0, true);
+    m.setTiming(80, 5);
+    CHECK(m.isSynced() && m.beaconDue(0) && !m.beaconDue(100) && m.beaconDue(240) && !m.beaconDue(479));
+    uint8_t b[TDMA_BEACON_LEN];
+    CHECK(m.buildBeacon(b, sizeof(b) - 1) == 0);
+    CHECK(m.buildBeacon(b, sizeof(b)) == TDMA_BEACON_LEN && classTdmaScheduler::isBeacon(b, sizeof(b)));
+    CHECK(!classTdmaScheduler::isBeacon(b, sizeof(b) - 1) && !m.onBeacon(b, sizeof(b), 0));
+    m.stampBeacon(b, 530);                  // 50 ms into the superframe at 480
+    CHECK(b[6] == 50 && b[7] == 0);
+
+    // Floor 2, its clock 1234 ms ahead, hears it 2 ms later: realigns to the
+    // master's superframe and takes its timing
+    classTdmaScheduler s;
+    s.configure(3, 1, false);
+    CHECK(s.onBeacon(b, sizeof(b), 530 + 1234 + 2));
+    unsigned long start = 480 + 1234 + 2;   // master's superframe start, local clock
+    CHECK(s.isSynced() && s.getBeacons() == 1 && s.getFrameMs() == 240);
+    CHECK(s.getLastCorrection() == (long)(start % 240));
+    CHECK(!s.inTxWindow(start + 84) && s.inTxWindow(start + 85) && s.inTxWindow(start + 154) && !s.inTxWindow(start + 155));
+
+    // Next beacon says the superframe started 10 ms earlier: correction -10,
+    // and the slot already reported this superframe isn't reported again
+    CHECK(s.slotStarted(start + 240 + 90));
+    m.stampBeacon(b, 770);                  // 50 ms into the superframe at 720
+    CHECK(s.onBeacon(b, sizeof(b), start + 240 + 50 - 10));
+    CHECK(s.getLastCorrection() == -10);
+    CHECK(!s.slotStarted(start + 240 + 100));
+
+    // Beacons stop: unsynced after TDMA_SYNC_LOSS_FRAMES superframes
+    unsigned long lastRx = start + 240 + 40;
+    s.service(lastRx + TDMA_SYNC_LOSS_FRAMES * 240);
+    CHECK(s.isSynced());
+    s.service(lastRx + TDMA_SYNC_LOSS_FRAMES * 240 + 1);
+    CHECK(!s.isSynced() && s.getSyncLosses() == 1);
+
+    // Superframe running across the millis() wrap: window [-40, 40) around 0
+    const unsigned long w = (unsigned long)0 - 150;
+    classTdmaScheduler m2;
+    m2.configure(3, 0, true);
+    m2.setTiming(100, 10);
+    m2.buildBeacon(b, sizeof(b));
+    m2.stampBeacon(b, 0);                   // offset 0
+    classTdmaScheduler x;
+    x.configure(3, 1, false);
+    CHECK(x.onBeacon(b, sizeof(b), w));
+    CHECK(!x.inTxWindow(w + 109) && x.inTxWindow(w + 110) && x.inTxWindow(39) && !x.inTxWindow(40));
+    CHECK(x.slotStarted(w + 120) && !x.slotStarted(20));
+    CHECK(!x.inTxWindow(w + 300 + 109) && x.inTxWindow(w + 300 + 110) && x.slotStarted(w + 300 + 110));
+    x.service(w + 300);
+    CHECK(x.isSynced());
+}
+
+// ---------------- MQTT publish policy ----------------
+static PayloadHash payload(const char* s) {
+    PayloadHash h;
+    h.print(s);
+    return h;
+}
+
+static void testMqttPublisher() {
+    classMqttPublisher<3> p;
+    p.setHeartbeatMs(1000);
+    PayloadHash on = payload("ON"), off = payload("OFF");
+
+    // First publish goes out whatever the state, then waits for a change
+    CHECK(p.due(0, false, 5) == MQTT_PUB_FIRST && !p.isRepeat(0, on));
+    p.published(0, MQTT_PUB_FIRST, on, 5);
+    CHECK(p.due(0, false, 6) == MQTT_PUB_NONE);
+
+    // A change is held back for the minimum interval, then sent
+    CHECK(p.due(0, true, 5 + MQTT_MIN_INTERVAL_MS - 1) == MQTT_PUB_NONE);
+    CHECK(p.due(0, true, 5 + MQTT_MIN_INTERVAL_MS) == MQTT_PUB_CHANGE);
+
+    // A value that flipped back to what was last sent is a repeat
+    CHECK(p.isRepeat(0, on) && p.topic(0)->unchanged == 1);
+    CHECK(!p.isRepeat(0, off) && !p.isRepeat(0, payload("OF")) && p.topic(0)->unchanged == 1);
+    p.published(0, MQTT_PUB_CHANGE, off, 300);
+
+    // Heartbeat only once nothing has changed for heartbeatMs
+    CHECK(p.due(0, false, 1299) == MQTT_PUB_NONE && p.due(0, false, 1300) == MQTT_PUB_HEARTBEAT);
+    CHECK(p.due(0, true, 1300) == MQTT_PUB_CHANGE);
+    p.published(0, MQTT_PUB_HEARTBEAT, off, 1300);
+    p.published(0, MQTT_PUB_ALARM, on, 1310);
+    const MqttTopicState* s = p.topic(0);
+    CHECK(s->published == 4 && s->heartbeats == 1 && s->alarms == 1 && s->lastMs == 1310);
+
+    // Per-topic interval leaves the other topics alone
+    p.setMinIntervalMs(1, 0);
+    p.published(1, MQTT_PUB_FIRST, on, 1310);
+    p.published(2, MQTT_PUB_FIRST, on, 1310);
+    CHECK(p.due(1, true, 1310) == MQTT_PUB_CHANGE && p.due(2, true, 1310) == MQTT_PUB_NONE);
+
+    // Reconnect: everything goes out again, counters kept
+    p.reset();
+    CHECK(p.due(0, false, 1311) == MQTT_PUB_FIRST && p.due(2, false, 1311) == MQTT_PUB_FIRST);
+    CHECK(!p.isRepeat(0, on) && p.topic(0)->published == 4);
+
+    // Out of range topics are never due and don't touch state
+    CHECK(p.due(3, true, 0) == MQTT_PUB_NONE && !p.isRepeat(3, on) && p.topic(3) == nullptr);
+    p.published(3, MQTT_PUB_FIRST, on, 0);
+
+    // Ages across the millis() wrap
+    classMqttPublisher<1> w;
+    const unsigned long last = (unsigned long)0 - 100;
+    w.published(0, MQTT_PUB_FIRST, on, last);
+    CHECK(w.due(0, true, last + MQTT_MIN_INTERVAL_MS - 1) == MQTT_PUB_NONE);
+    CHECK(w.due(0, true, last + MQTT_MIN_INTERVAL_MS) == MQTT_PUB_CHANGE);
+    CHECK(w.due(0, false, last + MQTT_HEARTBEAT_MS - 1) == MQTT_PUB_NONE);
+    CHECK(w.due(0, false, last + MQTT_HEARTBEAT_MS) == MQTT_PUB_HEARTBEAT);
+}
+
+// ---------------- I2C bus polling ----------------
+static void testI2cBus() {
+    TwoWire w;
+    w.answers[0x12] = w.answers[0x14] = w.answers[0x15] = true;
+    classI2cBus bus(w);
+    Serial.clear();
+    CHECK(bus.scan() == 3 && w.probes == I2C_NUM_ADDR);
+    CHECK(strstr(Serial.output().c_str(), "I2C 0x14 found") != nullptr);
+    CHECK(bus.device(0x11) == nullptr && bus.device(0x21) == nullptr && !bus.device(0x13)->present);
+
+    // 0x14 has a data-ready line on pin 4 (pulled up); the others have none
+    bus.setReadyPin(0x14, 4);
+    bus.setReadyPin(0x30, 4);               // not a Nano address: ignored
+    CHECK(digitalRead(4) == HIGH);
+
+    // Round-robin; the lined device gets its first read, then only slow reads
+    CHECK(bus.next(0) == 0x12); bus.polled(0x12, true, 0);
+    CHECK(bus.next(0) == 0x14); bus.polled(0x14, true, 0);
+    CHECK(bus.next(0) == 0x15); bus.polled(0x15, true, 0);
+    CHECK(bus.next(100) == 0x12); bus.polled(0x12, true, 100);
+    CHECK(bus.next(100) == 0x15); bus.polled(0x15, true, 100);
+    CHECK(bus.next(180) == 0x12); bus.polled(0x12, true, 180);
+    CHECK(bus.device(0x12)->cycleMs == 80 && bus.device(0x12)->cycleAvgMs == 98);
+
+    // Line pulled low: 0x14 is read first, for as long as it stays low
+    digitalWrite(4, LOW);
+    CHECK(bus.next(200) == 0x14 && bus.next(200) == 0x14 && bus.device(0x14)->readyReads == 2);
+    bus.polled(0x14, true, 200);
+    digitalWrite(4, HIGH);
+    CHECK(bus.next(200) == 0x15 && bus.next(200) == 0x12 && bus.next(449) == 0x15);
+    CHECK(bus.next(450) == 0x12 && bus.next(450) == 0x14 && bus.device(0x14)->readyReads == 2);
+
+    // A line shared by the rest: no continuous polling, flagged reads only
+    bus.setSharedReadyPin(5);
+    bus.polled(0x12, true, 450);
+    bus.polled(0x15, true, 450);
+    bus.polled(0x14, true, 450);
+    CHECK(bus.next(500) == 0);
+    digitalWrite(5, LOW);
+    CHECK(bus.next(500) == 0x15 && bus.next(500) == 0x12 && bus.next(500) == 0x15);
+    digitalWrite(5, HIGH);
+    bus.setSharedReadyPin(-1);
+
+    // Five failed reads in a row drop a device
+    w.answers[0x15] = false;
+    for (int i = 0; i < I2C_MAX_MISSES - 1; i++) bus.polled(0x15, false, 600 + i);
+    bus.polled(0x15, true, 610);
+    for (int i = 0; i < I2C_MAX_MISSES - 1; i++) bus.polled(0x15, false, 620 + i);
+    CHECK(bus.count() == 3);
+    bus.polled(0x15, false, 630);
+    CHECK(bus.count() == 2 && bus.device(0x15)->errors == 2 * (I2C_MAX_MISSES - 1) + 1);
+    CHECK(strstr(Serial.output().c_str(), "I2C 0x15 lost") != nullptr);
+
+    // Background scan: one absent address per I2C_SCAN_STEP_MS
+    const unsigned long t = 10000;
+    uint32_t probes = w.probes;
+    bus.service(t);                         // 0x12 present, probes 0x13
+    CHECK(w.probes == probes + 1);
+    bus.service(t + I2C_SCAN_STEP_MS - 1);
+    CHECK(w.probes == probes + 1);
+    w.answers[0x15] = true;
+    bus.service(t + I2C_SCAN_STEP_MS);      // 0x14 present, probes 0x15
+    CHECK(w.probes == probes + 2 && bus.count() == 3 && bus.device(0x15)->misses == 0);
+
+    // Frames built but never read, from the Nano's sequence numbers
+    bus.frameSeq(0x12, 254);
+    bus.frameSeq(0x12, 255);
+    bus.frameSeq(0x12, 2);                  // 0 and 1 missed across the wrap
+    CHECK(bus.device(0x12)->skipped == 2);
+    bus.frameSeq(0x12, 1);                  // old frame, not a gap
+    CHECK(bus.device(0x12)->skipped == 2);
+}
+
+// ---------------- I2C frame (CRC-8, poly 0x07) ----------------
+static void testI2cFrame() {
+    // Standard CRC-8 check value: "123456789" -> 0xF4
+    CHECK(i2cCrc8((const uint8_t*)"123456789", 9) == 0xF4);
+    CHECK(i2cCrc8(nullptr, 0) == 0);
+
+    I2cReading rd = {}, back = {};
+    rd.seq = 77; rd.f = 1; rd.r = 3; rd.type = I2C_T_ULTRA; rd.id = 2; rd.value = 0x1234;
+    uint8_t frame[I2C_FRAME_LEN + 1];
+    i2cBuildFrame(rd, frame);
+    CHECK(frame[0] == I2C_FRAME_LEN && frame[6] == 0x34 && frame[7] == 0x12);
+    CHECK(frame[I2C_FRAME_LEN - 1] == i2cCrc8(frame, I2C_FRAME_LEN - 1));
+
+    CHECK(i2cParseFrame(frame, I2C_FRAME_LEN, back));
+    CHECK(back.seq == rd.seq && back.f == rd.f && back.r == rd.r && back.type == rd.type
+          && back.id == rd.id && back.value == rd.value);
+
+    // Truncated, or a wrong length byte
+    for (size_t len = 0; len < I2C_FRAME_LEN; len++) CHECK(!i2cParseFrame(frame, len, back));
+    CHECK(!i2cParseFrame(nullptr, I2C_FRAME_LEN, back));
+    frame[0] = I2C_FRAME_LEN + 1;
+    CHECK(!i2cParseFrame(frame, I2C_FRAME_LEN, back));
+    frame[0] = I2C_FRAME_LEN;
+
+    // Any single-bit error, in the data or the CRC itself
+    int caught = 0;
+    for (size_t bit = 0; bit < I2C_FRAME_LEN * 8; bit++) {
+        frame[bit / 8] ^= (uint8_t)(1 << (bit % 8));
+        caught += !i2cParseFrame(frame, I2C_FRAME_LEN, back);
+        frame[bit / 8] ^= (uint8_t)(1 << (bit % 8));
+    }
+    CHECK(caught == I2C_FRAME_LEN * 8);
+
+    // Idle line reads back as 0xFF
+    memset(frame, 0xFF, sizeof(frame));
+    CHECK(!i2cParseFrame(frame, I2C_FRAME_LEN, back));
+}
+
+// ---------------- Room delta string ----------------
+static void testRoomDelta() {
+    setupRoom();
+    CHECK(buildRoomDeltaString(1, 2, SINK_ESP) == "f/1/r/2/cs:1;u/0:42;u/3:200;h/1:1;h/2:0");
+    CHECK(buildRoomDeltaString(1, 2, SINK_ESP) == "");              // cleared
+    CHECK(isRoomDirty(1, 2, SINK_MQTT));                             // other sink untouched
+
+    setUltraValue(1, 2, 3, 201);
+    CHECK(buildRoomDeltaString(1, 2, SINK_ESP) == "f/1/r/2;u/3:201");
+
+    // Timestamp only: nothing to send, and not left dirty
+    setRoomTimestamp(1, 2, 1698312390UL);
+    CHECK(isRoomDirty(1, 2, SINK_ESP));
+    CHECK(buildRoomDeltaString(1, 2, SINK_ESP) == "");
+    CHECK(!isRoomDirty(1, 2, SINK_ESP));
+
+    setRoomTimestamp(1, 2, 1698312391UL);
+    CHECK(isRoomDirty(1, 2, SINK_ESP) && !isRoomDataDirty(1, 2, SINK_ESP));
+    setHallOpen(1, 2, 2, true);
+    CHECK(isRoomDataDirty(1, 2, SINK_ESP));
+}
+
+// ---------------- Topic builders (tables or on-demand) ----------------
+// ---------------- System list in chunks (ELEC520/security/system) ----------------
+struct Chunks { String joined, part[32]; size_t count = 0, longest = 0; bool clean = true; int failAt = -1; };
+
+static bool collectChunk(const char* data, size_t len, void* ctx) {
+    Chunks& c = *(Chunks*)ctx;
+    if ((int)c.count == c.failAt) return false;
+    if (len == 0 || data[0] == ';' || data[len - 1] == ';') c.clean = false;
+    if (c.count == 32) return false;
+    String& part = c.part[c.count++];
+    part.concat(data, len);
+    if (c.joined.length()) c.joined += ';';
+    c.joined += part;
+    if (len > c.longest) c.longest = len;
+    return true;
+}
+
+static void testSystemChunks() {
+    setupRoom();
+    for (uint8_t r = 3; r < 6; r++) {
+        setRoomConnected(1, r, true);
+        setUltraValue(1, r, 1, 100 + r);
+        setHallOpen(1, r, 0, r & 1);
+    }
+    setRoomTimestamp(1, 2, 1698312390);
+    String whole = buildSystemMqttString();
+    char buf[40];
+
+    // Split at ';' into messages that fit, rejoined they are the whole list
+    Chunks c;
+    size_t n = writeSystemMqttChunked(buf, sizeof(buf), collectChunk, &c);
+    CHECK(n == c.count && n > 1 && whole.length() > sizeof(buf));
+    CHECK(c.longest <= sizeof(buf) && c.clean);
+    CHECK(c.joined == whole);
+
+    // Each message parses on its own
+    resetModel();
+    bool allParsed = true;
+    for (size_t i = 0; i < c.count; i++)
+        allParsed = parseSystemMqtt(c.part[i].c_str(), c.part[i].length()) && allParsed;
+    CHECK(allParsed && buildSystemMqttString() == whole);
+
+    // A buffer that holds the whole list sends it as one message
+    char big[512];
+    Chunks one;
+    CHECK(whole.length() <= sizeof(big));
+    CHECK(writeSystemMqttChunked(big, sizeof(big), collectChunk, &one) == 1 && one.joined == whole);
+
+    // A token longer than a message, or a failed send: 0
+    Chunks tiny, fail;
+    fail.failAt = 1;
+    CHECK(writeSystemMqttChunked(buf, 5, collectChunk, &tiny) == 0);
+    CHECK(writeSystemMqttChunked(buf, sizeof(buf), collectChunk, &fail) == 0 && fail.count == 1);
+
+    CHECK(strcmp(cloudTopicSystem(), "ELEC520/security/system") == 0);
+}
+
+static void testTopics() {
+    const uint8_t F = SMP_MAX_FLOORS - 1, R = SMP_MAX_ROOMS - 1, S = SMP_MAX_SENSORS - 1;
+    char want[64];
+
+    CHECK(strcmp(cloudTopicFloor(1), "ELEC520/security/f/1") == 0);
+    CHECK(strcmp(nodeTopicRoomConnection(1, 2), "f/1/r/2/cs") == 0);
+    CHECK(strcmp(cloudTopicRoomTimestamp(1, 2), "ELEC520/security/f/1/r/2/ts") == 0);
+    snprintf(want, sizeof(want), "ELEC520/security/f/%u/r/%u/u/%u", F, R, S);
+    CHECK(strcmp(cloudTopicUltra(F, R, S), want) == 0);
+    snprintf(want, sizeof(want), "f/%u/r/%u/h/%u", F, R, S);
+    CHECK(strcmp(nodeTopicHall(F, R, S), want) == 0);
+    CHECK(*cloudTopicUltra(SMP_MAX_FLOORS, 0, 0) == '\0');
+    CHECK(*nodeTopicHall(0, 0, SMP_MAX_SENSORS) == '\0');
+
+    // Results held together stay distinct (up to SMP_TOPIC_RING of them)
+    const char* a = nodeTopicUltra(1, 2, 3);
+    const char* b = nodeTopicHall(1, 2, 3);
+    CHECK(strcmp(a, "f/1/r/2/u/3") == 0 && strcmp(b, "f/1/r/2/h/3") == 0);
+}
+
+// ---------------- Ultrasonic filter (median / EMA / deadband) ----------------
+static int pushN(DistFilter& f, uint8_t cm, int n) {
+    int changed = 0;
+    while (n--) changed += filterPush(f, cm);
+    return changed;
+}
+
+static void testFilter() {
+    DistFilter f;
+    filterInit(f, 5, 2, 2);
+    CHECK(filterOut(f) == FILTER_NO_VALUE);
+
+    // First good reading is reported straight away
+    CHECK(filterPush(f, 100));
+    CHECK(filterOut(f) == 100 && filterEmaCm(f) == 100);
+    CHECK(pushN(f, 100, 4) == 0);
+
+    // One bad echo never gets past the median
+    CHECK(!filterPush(f, 180));
+    CHECK(!filterPush(f, 3));
+    CHECK(filterOut(f) == 100);
+
+    // Jitter inside the deadband holds the output
+    const uint8_t jitter[] = { 99, 101, 102, 98, 100, 101, 99, 102 };
+    for (uint8_t cm : jitter) CHECK(!filterPush(f, cm));
+    CHECK(filterOut(f) == 100);
+
+    // Step 100 -> 120: converges to within the deadband, in a few steps,
+    // never overshooting and never moving backwards
+    uint16_t before = f.changes;
+    uint8_t last = filterOut(f);
+    bool monotonic = true;
+    for (int i = 0; i < 30; i++) {
+        filterPush(f, 120);
+        if (filterOut(f) < last || filterOut(f) > 120) monotonic = false;
+        last = filterOut(f);
+    }
+    CHECK(monotonic);
+    CHECK(filterOut(f) >= 118 && filterOut(f) <= 120);
+    CHECK(f.changes - before >= 2 && f.changes - before <= 6);
+
+    // No echo: needs a median majority, then is reported at once
+    CHECK(pushN(f, FILTER_NO_VALUE, 2) == 0);
+    CHECK(filterOut(f) != FILTER_NO_VALUE);
+    CHECK(filterPush(f, FILTER_NO_VALUE));
+    CHECK(filterOut(f) == FILTER_NO_VALUE);
+
+    // Recovery restarts the EMA at the new distance instead of easing in
+    CHECK(pushN(f, 60, 3) == 1);
+    CHECK(filterOut(f) == 60 && filterEmaCm(f) == 60);
+
+    // N=1, k=0, deadband 0: every whole-cm change goes straight through
+    filterInit(f, 1, 0, 0);
+    CHECK(filterPush(f, 50) && filterOut(f) == 50);
+    CHECK(filterPush(f, 51) && filterOut(f) == 51);
+    CHECK(!filterPush(f, 51));
+    CHECK(filterPush(f, 200) && filterOut(f) == 200);
+    CHECK(f.samples == 4 && f.changes == 3);
+
+    // Out-of-range tuning is clamped
+    filterInit(f, 20, 12, 0);
+    CHECK(f.medianN == FILTER_MEDIAN_MAX && f.emaShift == 7);
+}
+
+int main() {
+    testRoomFrame();
+    testBatchFrame();
+    testSeqWrapper();
+    testTxQueueBackoff();
+    testTdma();
+    testMqttPublisher();
+    testI2cBus();
+    testI2cFrame();
+    testRoomDelta();
+    testTopics();
+    testSystemChunks();
+    testFilter();
+
+    printf("%d checks, %d failed\n", checks, failures);
+    return failures ? 1 : 0;
+}
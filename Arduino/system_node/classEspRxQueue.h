@@ -0,0 +1,78 @@
+#ifndef CLASS_ESP_RX_QUEUE
+#define CLASS_ESP_RX_QUEUE
+
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <Arduino.h>
+#include <esp_now.h>
+
+#define ESP_RX_QUEUE_LEN 8   //Frames held between the ESP-NOW callback and loop(). Power of two.
+#define ESP_RX_BATCH     4   //Frames parsed per loop() pass.
+
+//One received ESP-NOW frame, copied out of the radio buffer.
+struct EspRxFrame {
+    uint8_t src[6];
+    int8_t  rssi;
+    uint8_t len;
+    unsigned long rxMs;                       //millis() when the callback ran.
+    uint8_t data[ESP_NOW_MAX_DATA_LEN + 1];   //+1 so text payloads can be null-terminated.
+};
+
+//Single-producer/single-consumer ring of EspRxFrame.
+//Producer: the ESP-NOW receive callback (Wi-Fi task). Consumer: loop().
+//No locks and no heap; each side only writes its own index.
+template <uint8_t N>
+class classEspRxQueue {
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "queue length must be a power of two");
+
+private:
+    EspRxFrame _slots[N];
+    std::atomic<uint32_t> _head{0};       //Written by the producer only.
+    std::atomic<uint32_t> _tail{0};       //Written by the consumer only.
+    std::atomic<uint32_t> _dropped{0};    //Frames lost because the ring was full.
+    std::atomic<uint32_t> _received{0};   //Frames accepted.
+    std::atomic<uint32_t> _highWater{0};  //Most frames ever waiting at once.
+
+public:
+    //Producer side. Returns false (and counts a drop) when full.
+    bool push(const uint8_t* src, int rssi, const uint8_t* data, int len) {
+        if (len <= 0 || len > ESP_NOW_MAX_DATA_LEN) { _dropped.fetch_add(1, std::memory_order_relaxed); return false; }
+
+        uint32_t h = _head.load(std::memory_order_relaxed);
+        uint32_t t = _tail.load(std::memory_order_acquire);
+        if (h - t >= N) { _dropped.fetch_add(1, std::memory_order_relaxed); return false; }
+
+        EspRxFrame& f = _slots[h & (N - 1)];
+        memcpy(f.src, src, 6);
+        f.rssi = (int8_t)rssi;
+        f.rxMs = millis();
+        f.len  = (uint8_t)len;
+        memcpy(f.data, data, len);
+        f.data[len] = '\0';
+
+        _head.store(h + 1, std::memory_order_release);
+        _received.fetch_add(1, std::memory_order_relaxed);
+
+        uint32_t depth = h + 1 - t;
+        if (depth > _highWater.load(std::memory_order_relaxed)) _highWater.store(depth, std::memory_order_relaxed);
+        return true;
+    }
+
+    //Consumer side. Oldest frame or nullptr; valid until pop().
+    const EspRxFrame* front() const {
+        uint32_t t = _tail.load(std::memory_order_relaxed);
+        if (t == _head.load(std::memory_order_acquire)) return nullptr;
+        return &_slots[t & (N - 1)];
+    }
+
+    void pop() { _tail.store(_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+    uint32_t pending()   const { return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_relaxed); }
+    uint32_t dropped()   const { return _dropped.load(std::memory_order_relaxed); }
+    uint32_t received()  const { return _received.load(std::memory_order_relaxed); }
+    uint32_t highWater() const { return _highWater.load(std::memory_order_relaxed); }
+    uint8_t  capacity()  const { return N; }
+};
+
+#endif
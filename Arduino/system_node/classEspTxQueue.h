@@ -0,0 +1,130 @@
+#ifndef CLASS_ESP_TX_QUEUE
+#define CLASS_ESP_TX_QUEUE
+
+#include <cstdint>
+#include <cstring>
+#include <Arduino.h>
+#include <esp_now.h>
+
+#define ESP_TX_QUEUE_LEN   16     //Frames waiting to go out. Power of two.
+#define ESP_TX_MIN_GAP_MS  5      //Default gap between a send completing and the next send.
+#define ESP_TX_TIMEOUT_US  50000  //Give up on a send callback after this long.
+#define ESP_TX_MAX_RETRIES    4    //Resends of a failed frame before it is dropped.
+#define ESP_TX_BACKOFF_MIN_MS 10   //First retry delay, doubled per retry...
+#define ESP_TX_BACKOFF_MAX_MS 160  //...up to this.
+
+//Sequenced frame: [hdr][seq][payload]. Everything except TDMA beacons is
+//wrapped so receivers can drop retried duplicates and count gaps.
+#define ESP_SEQ_HDR 0xD1
+#define ESP_SEQ_LEN 2
+#define ESP_SEQ_PAYLOAD_MAX (ESP_NOW_MAX_DATA_LEN - ESP_SEQ_LEN)
+
+//Strips the sequenced header from a received frame. False (data/len
+//untouched) when the frame isn't sequenced.
+inline bool espSeqUnwrap(const uint8_t*& data, size_t& len, uint8_t& seq) {
+    if (!data || len < ESP_SEQ_LEN || data[0] != ESP_SEQ_HDR) return false;
+    seq = data[1];
+    data += ESP_SEQ_LEN;
+    len -= ESP_SEQ_LEN;
+    return true;
+}
+
+//One outbound ESP-NOW frame.
+struct EspTxFrame {
+    uint8_t dst[6];
+    uint8_t len;
+    uint8_t tries;                  //Retries so far.
+    unsigned long retryAtMs;        //Not sent again before this (millis()).
+    uint32_t stampUs;               //micros() when queued (alarm frames: when detected).
+    uint8_t data[ESP_NOW_MAX_DATA_LEN];
+};
+
+//Fixed-size FIFO of EspTxFrame. Both ends run in loop(); the send-complete
+//callback only signals classFloorNode, it never touches the queue.
+template <uint8_t N>
+class classEspTxQueue {
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "queue length must be a power of two");
+
+private:
+    EspTxFrame _slots[N];
+    uint32_t _head = 0;
+    uint32_t _tail = 0;
+    uint32_t _dropped = 0;    //Frames refused because the queue was full.
+    uint32_t _highWater = 0;  //Most frames ever waiting at once.
+
+public:
+    //Returns false (and counts a drop) when full or len is out of range.
+    bool push(const uint8_t* dst, const uint8_t* data, size_t len) {
+        EspTxFrame* f = claim(dst, len);
+        if (!f) return false;
+        memcpy(f->data, data, len);
+        return true;
+    }
+
+    //As push(), wrapped in a sequenced header.
+    bool pushSeq(const uint8_t* dst, uint8_t seq, const uint8_t* data, size_t len) {
+        EspTxFrame* f = claim(dst, len + ESP_SEQ_LEN);
+        if (!f) return false;
+        f->data[0] = ESP_SEQ_HDR;
+        f->data[1] = seq;
+        memcpy(f->data + ESP_SEQ_LEN, data, len);
+        return true;
+    }
+
+    //Oldest frame or nullptr; valid until pop() or remove().
+    EspTxFrame* front() { return (_head == _tail) ? nullptr : &_slots[_tail & (N - 1)]; }
+    //Newest frame or nullptr.
+    EspTxFrame* back()  { return (_head == _tail) ? nullptr : &_slots[(_head - 1) & (N - 1)]; }
+    void pop() { if (_head != _tail) _tail++; }
+
+    //Oldest frame that may go out at now, or nullptr. Skips a frame backing
+    //off after a failed send and everything queued behind it for the same
+    //destination, so one dead peer doesn't hold up the others and each peer
+    //still gets its frames in order.
+    EspTxFrame* nextReady(unsigned long now) {
+        for (uint32_t i = _tail; i != _head; i++) {
+            EspTxFrame& f = _slots[i & (N - 1)];
+            if (queuedBefore(i, f.dst)) continue;
+            if (f.tries && (long)(now - f.retryAtMs) < 0) continue;
+            return &f;
+        }
+        return nullptr;
+    }
+
+    //Removes f (a frame from front() or nextReady()); the frames queued
+    //before it move up one slot and keep their order.
+    void remove(EspTxFrame* f) {
+        if (_head == _tail || f < _slots || f >= _slots + N) return;
+        uint32_t i = _tail + (((uint32_t)(f - _slots) - _tail) & (N - 1));
+        if (i - _tail >= _head - _tail) return;
+        for (; i != _tail; i--) _slots[i & (N - 1)] = _slots[(i - 1) & (N - 1)];
+        _tail++;
+    }
+
+    uint32_t pending()   const { return _head - _tail; }
+    uint32_t dropped()   const { return _dropped; }
+    uint32_t highWater() const { return _highWater; }
+    uint8_t  capacity()  const { return N; }
+
+private:
+    bool queuedBefore(uint32_t i, const uint8_t* dst) const {
+        for (uint32_t j = _tail; j != i; j++)
+            if (memcmp(_slots[j & (N - 1)].dst, dst, 6) == 0) return true;
+        return false;
+    }
+
+    EspTxFrame* claim(const uint8_t* dst, size_t len) {
+        if (len == 0 || len > ESP_NOW_MAX_DATA_LEN || _head - _tail >= N) { _dropped++; return nullptr; }
+        EspTxFrame& f = _slots[_head & (N - 1)];
+        memcpy(f.dst, dst, 6);
+        f.len = (uint8_t)len;
+        f.tries = 0;
+        f.retryAtMs = 0;
+        f.stampUs = micros();
+        _head++;
+        if (_head - _tail > _highWater) _highWater = _head - _tail;
+        return &f;
+    }
+};
+
+#endif
@@ -2,13 +2,49 @@
 #define CLASS_FLOOR_NODE
 
 #include <cstdint>
+#include <atomic>
 #include <PubSubClient.h>
 #include <esp_now.h>
 #include <esp_wifi.h>
 #include <WiFi.h>
 #include "elec520_protocol.h"
+#include "classEspRxQueue.h"
+#include "classEspTxQueue.h"
+#include "classTdmaScheduler.h"
+#include "classPeerTable.h"
+#include "classMqttPublisher.h"
 
 #define NUM_SAMPLES 50
+#define FULL_REFRESH_MS 60000 //Full state resend period; deltas in between.
+#define ESP_ALARM_QUEUE_LEN PEER_TABLE_LEN //Alarm frames waiting (one copy per peer); sent ahead of everything else.
+#define MQTT_BUFFER_SIZE 1024 //Largest MQTT message handled (PubSubClient drops bigger ones).
+#define MQTT_SYSTEM_CHUNK_MAX (MQTT_BUFFER_SIZE - 64) //System list payload per message, leaving room for topic and header.
+
+// Rooms of this floor, bit n = room n (room IDs run 0..SMP_MAX_ROOMS-1).
+typedef ProtocolModel::Floor::Mask EspRoomMask;
+static_assert(SMP_MAX_ROOMS <= sizeof(EspRoomMask) * 8, "room mask must cover SMP_MAX_ROOMS");
+
+// Room payload format sent over ESP-NOW. Receivers accept both.
+enum EspRoomFormat : uint8_t { ESP_FMT_TEXT = 0, ESP_FMT_BINARY = 1 };
+
+// MQTT broker link, advanced by mqttOperate() without blocking loop().
+enum MqttLinkState : uint8_t {
+    MQTT_WAIT_WIFI = 0,   //No Wi-Fi link; nothing to try yet.
+    MQTT_BACKOFF   = 1,   //Last attempt failed (or link dropped); waiting to retry.
+    MQTT_CONNECTED = 2,
+    MQTT_CONNECTING = 3   //Connect running in the connect task; loop() leaves the client alone.
+};
+#define MQTT_BACKOFF_MIN_MS 1000    //First retry delay; doubles per failure...
+#define MQTT_BACKOFF_MAX_MS 60000   //...up to this.
+#define MQTT_CONNECT_TIMEOUT_MS 2000 //TCP connect and socket read/write timeout.
+#define MQTT_SOCKET_TIMEOUT_S 2     //PubSubClient wait for CONNACK and packet bodies (seconds).
+#define MQTT_TASK_STACK 4096        //Connect task stack (bytes).
+
+// Connect task -> loop() result of one attempt.
+enum : uint8_t { MQTT_CONN_PENDING = 0, MQTT_CONN_OK = 1, MQTT_CONN_FAILED = 2 };
+
+// Wi-Fi link changes flagged by the event task, printed from loop().
+enum : uint8_t { WIFI_LOG_UP = 0x01, WIFI_LOG_DOWN = 0x02 };
 
 class classFloorNode {
 //*********************************************************************************************** */
@@ -50,26 +86,72 @@ private:
     struct_message strucTXMessage;
     struct_message strucRXMessage;
 
-    esp_now_peer_info_t peerInfo = {};          //ESP Peer information.
+    esp_now_peer_info_t peerInfo = {};          //ESP Peer information (broadcast).
 
-    // Peer Node structure
-    typedef struct peer_node_data {
-        uint32_t uiMacAddress;
-    } peer_node_data;
-
-    peer_node_data uiPeerMacAddressStorage[8] = {};   //Peer address storage.
-    int iPA = 0;                                //Peer address storage element.
+    classPeerTable<PEER_TABLE_LEN> _peers;      //Nodes heard from, keyed by full MAC.
 
     uint32_t uiThisFloorNodeMacID;
 
     unsigned long startTime;
     unsigned long baseStationConnectionTime;
-    byte bTransmitPosition = 0b0000'0001;
 
     unsigned long _lastFloorSentMsg; //
 
     uint8_t _uiNumRoom;
 
+    EspRoomFormat _espFormat = ESP_FMT_BINARY; //Text kept for debugging.
+
+    unsigned long _lastFullEspMs = 0;          //Last full (non-delta) ESP-NOW send.
+    bool _fullEspSent = false;
+
+    classEspRxQueue<ESP_RX_QUEUE_LEN> _rxQueue; //ESP-NOW callback -> loop() hand-off.
+
+    classEspTxQueue<ESP_TX_QUEUE_LEN> _txQueue; //Outbound frames, paced by processTransmit().
+    uint16_t _txGapMs = ESP_TX_MIN_GAP_MS;
+    bool _txInFlight = false;                  //Front frame handed to esp_now_send().
+    unsigned long _txSentUs = 0;               //micros() at esp_now_send().
+    unsigned long _txIdleSinceMs = 0;          //millis() the last send finished.
+    std::atomic<uint32_t> _txCallbacks{0};     //Send callbacks so far, counted by onESPSent() (Wi-Fi task).
+    uint32_t _txCallbacksSeen = 0;             //...and taken by processTransmit().
+    volatile bool _txOk = false;               //Result and time of the latest callback.
+    volatile unsigned long _txDoneUs = 0;
+    bool _txLate = false;                      //A timed-out send's callback may still come.
+    unsigned long _txLateSinceUs = 0;          //micros() it timed out.
+    uint32_t _txSent = 0, _txFailed = 0, _txTimeouts = 0;
+    uint32_t _txLatencyUs = 0, _txLatencyMaxUs = 0;  //Last / worst send-to-callback time.
+    uint8_t  _txSeq = 0;                       //Next sequence number (one per logical frame).
+    uint32_t _txDelivered = 0, _txGaveUp = 0, _txRetries = 0;
+    uint32_t _txRetryDepth[ESP_TX_MAX_RETRIES + 1] = {};  //Delivered frames by retries needed.
+    uint32_t _rxDuplicates = 0;
+
+    classEspTxQueue<ESP_ALARM_QUEUE_LEN> _alarmTxQueue; //Sent first, and outside the TDMA slot.
+    static_assert(ESP_ALARM_QUEUE_LEN >= PEER_TABLE_LEN, "alarm queue must hold a copy for every peer");
+    bool _txFromAlarm = false;                 //In-flight frame came from _alarmTxQueue.
+    EspTxFrame* _txFrame = nullptr;            //In-flight frame (a queue slot).
+    uint32_t _alarmEvents = 0;
+    uint32_t _alarmEspUs = 0, _alarmEspMaxUs = 0;    //Detection to ESP-NOW send callback.
+    uint32_t _alarmMqttUs = 0, _alarmMqttMaxUs = 0;  //Detection to MQTT publish written.
+
+    classTdmaScheduler _tdma;                  //Floor transmit slots; floor 1 (base station) sends the beacon.
+
+    MqttLinkState _mqttState = MQTT_WAIT_WIFI;
+    unsigned long _mqttRetryAtMs = 0;          //Next connect attempt (millis()).
+    uint32_t _mqttBackoffMs = MQTT_BACKOFF_MIN_MS;
+    uint32_t _mqttAttempts = 0;                //Connect attempts since boot.
+    uint32_t _mqttFailStreak = 0;              //Consecutive failed attempts.
+    uint32_t _mqttConnects = 0;                //Successful connects since boot.
+    classMqttPublisher<SMP_MAX_FLOORS> _mqttPub; //Per-floor-topic publish policy.
+    TaskHandle_t _mqttTask = nullptr;          //Runs client.connect(); started on the first attempt.
+    std::atomic<uint8_t> _mqttConnResult{MQTT_CONN_PENDING}; //MQTT_CONN_* from the connect task.
+    volatile int _mqttConnRc = 0;              //client.state() after the last attempt.
+    bool _mqttIpResolved = false;              //Broker IP looked up (connect task only).
+
+    volatile bool _wifiReady = false;          //STA has an IP (set from the Wi-Fi event task).
+    volatile unsigned long _wifiUpMs = 0;      //millis() of the first IP, 0 until then.
+    volatile uint32_t _wifiIp = 0;             //Last IP, as IPAddress(uint32_t) takes it.
+    volatile unsigned long _wifiIpMs = 0;      //millis() it was assigned.
+    std::atomic<uint8_t> _wifiLog{0};          //WIFI_LOG_* events for loop() to print.
+
 
     // --- Static callbacks that forward into the instance ---
     static void mqttCallbackStatic(char* topic, byte* payload, unsigned int length) {
@@ -84,6 +166,18 @@ private:
         if (instance) instance->onReceive(info, data, len);
     }
 
+    static void wifiEventStatic(arduino_event_id_t event, arduino_event_info_t info) {
+        if (instance) instance->onWifiEvent(event, info);
+    }
+
+    static void mqttConnectTaskStatic(void* arg) {
+        classFloorNode* self = (classFloorNode*)arg;
+        for (;;) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            self->mqttConnect();
+        }
+    }
+
 
     //Convert the mac address into a int value
     uint32_t macToShortInt(const uint8_t *mac) {
@@ -95,22 +189,32 @@ private:
     }
 
 
-    //Stores the Peers mac address
-    void storePeerDetails(uint32_t macID){
-        //check if address already exists. 
-        // Serial.printf("Checking Peer address......");
-        for (int i = 0; i<8; i++){
-            if(uiPeerMacAddressStorage[i].uiMacAddress == macID) {
-                //Serial.printf("Peer address already stored\n");
-                return;
-            } else { //store the address into the storage
-                uiPeerMacAddressStorage[iPA].uiMacAddress = macID;
-                iPA++;
-                Serial.printf("Peer address: %d SAVED! \n", macID);
-                return;
-            }
+    //Record a frame from src; new senders are registered with ESP-NOW so
+    //later traffic to them can be unicast (MAC-level ACK and retries).
+    EspPeer* storePeerDetails(const uint8_t* src, int8_t rssi, unsigned long rxMs){
+        static const uint8_t bcast[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+        if (memcmp(src, bcast, 6) == 0) return nullptr;
+
+        bool added;
+        EspPeer* p = _peers.findOrAdd(src, added);
+        if (!p) return nullptr;   //Table full: the node still works, via broadcast.
+
+        if (added) {
+            esp_now_peer_info_t info = {};
+            memcpy(info.peer_addr, src, 6);
+            info.channel = 0;
+            info.encrypt = false;
+            if (!esp_now_is_peer_exist(src) && esp_now_add_peer(&info) != ESP_OK)
+                Serial.println("Failed to add peer");
+            Serial.printf("Peer %02X:%02X:%02X:%02X:%02X:%02X registered (%u known)\n",
+                          src[0], src[1], src[2], src[3], src[4], src[5], (unsigned)_peers.count());
+            p->rssiAvg = rssi;
         }
-        
+        p->rssi = rssi;
+        p->rssiAvg = (int8_t)(p->rssiAvg + (rssi - p->rssiAvg) / 8);
+        p->lastSeenMs = rxMs;
+        p->rxFrames++;
+        return p;
     }
 
 
@@ -126,6 +230,61 @@ private:
     PubSubClient& getClient() { return client; }
 
 
+    //Batches small writes so a streamed publish doesn't hit the socket once per byte.
+    class ChunkedPrint : public Print {
+    public:
+        explicit ChunkedPrint(Print& dst) : _dst(dst) {}
+        ~ChunkedPrint() { flush(); }
+        size_t write(uint8_t c) override {
+            if (_n == sizeof(_buf)) flush();
+            _buf[_n++] = c;
+            return 1;
+        }
+        size_t write(const uint8_t* data, size_t len) override {
+            for (size_t i = 0; i < len; i++) write(data[i]);
+            return len;
+        }
+        void flush() override { if (_n) { _dst.write(_buf, _n); _n = 0; } }
+    private:
+        Print& _dst;
+        uint8_t _buf[64];
+        size_t _n = 0;
+    };
+
+
+    //MQTT publish one floor's full state, retained, if _mqttPub says it is due.
+    //The payload is streamed twice: once into a hash (length, and whether it
+    //differs from the last publish), then into the client.
+    bool publishFloor(uint8_t f_id, unsigned long now, bool alarm = false) {
+        MqttPublishReason why = alarm ? MQTT_PUB_ALARM : _mqttPub.due(f_id, isFloorDirty(f_id, SINK_MQTT), now);
+        if (why == MQTT_PUB_NONE) return false;
+
+        PayloadHash h;
+        writeFloorMqtt(h, f_id);
+        if (h.length() == 0) return false;
+        if (why == MQTT_PUB_CHANGE && _mqttPub.isRepeat(f_id, h)) {
+            clearFloorDirty(f_id, SINK_MQTT);
+            return false;
+        }
+
+        const char* topic = cloudTopicFloor(f_id);
+        if (!client.beginPublish(topic, h.length(), true)) return false;
+        {
+            ChunkedPrint out(client);
+            writeFloorMqtt(out, f_id);
+        }
+        bool ok = client.endPublish() != 0;
+        if (ok) {
+            clearFloorDirty(f_id, SINK_MQTT);
+            _mqttPub.published(f_id, why, h, now);
+        }
+        static const char* const reasons[] = { "", "first", "change", "heartbeat", "ALARM" };
+        Serial.printf("MQTT Publish [%s]: %u bytes (%s)%s\n", topic, (unsigned)h.length(),
+                      reasons[why], ok ? "" : " FAILED");
+        return ok;
+    }
+
+
     //WIFI Set the Wifi Credentials
     void setWifiNetworkCredentials(const char* ssid, const char* password) {
         _ssid = ssid;
@@ -133,18 +292,37 @@ private:
     }
 
 
-    //MQTT callback function
+    //MQTT callback function. Routed by topic; payloads are parsed in place
+    //from the client buffer (not NUL-terminated, never copied). A bad payload
+    //on a known topic is dropped, never retried as another format.
     void MqttCallBack(char* topicC, byte* payload, unsigned int length) {
-        static char buf[256];
-        unsigned int n = (length < sizeof(buf)-1) ? length : sizeof(buf)-1;
-        memcpy(buf, payload, n);
-        buf[n] = '\0';
-
-        //Parse the Mqtt data into MODEL. 
-        parseSystemMqttString(String(buf));
+        //Our own retained floor publishes come back on the wildcard subscription.
+        if (isFloorTopic(topicC)) return;
+
+        //The "topic:value;..." list, possibly split over several messages
+        //(each at most MQTT_SYSTEM_CHUNK_MAX bytes, see writeSystemMqttChunked()).
+        if (strcmp(topicC, cloudTopicSystem()) == 0) {
+            if (!parseSystemMqtt(payload, length))
+                Serial.printf("MQTT Callback [%s]: nothing parsed (%u bytes)\n", topicC, length);
+            return;
+        }
 
-        // Serial.printf("MQTT Callback [%s]: %s\n", topicC, buf);
+        //Single-value topics: ELEC520/security/s/st, .../f/1/r/2/h/1, ...
+        TopicRef t;
+        if (!parseTopic(topicC, strlen(topicC), true, t)) {
+            Serial.printf("MQTT Callback [%s]: topic not handled, dropped\n", topicC);
+            return;
+        }
+        if (!applyTopic(t, (const char*)payload, length))
+            Serial.printf("MQTT Callback [%s]: bad value (%u bytes), dropped\n", topicC, length);
+    }
 
+    //True for ELEC520/security/f/{f}, the per-floor topics this node publishes.
+    bool isFloorTopic(const char* topic) {
+        for (int i=1; i<iNumOfFloors+1; i++){
+            if (strcmp(topic, cloudTopicFloor(i)) == 0) return true;
+        }
+        return false;
     }
 
 
@@ -156,37 +334,131 @@ private:
     }
 
 
-    //MQTT Reconnect with the broker
-    void brokerReconnect() {
-        while (!client.connected()) {
-            Serial.print("Attempting MQTT connection...\n");
-            if (client.connect(_mqtt_client_id)) {
-                Serial.println("connected");
-                client.subscribe("ELEC520/security/#");
-            } else {
-                Serial.printf("failed, rc=%d. retry in 5s\n", client.state());
-                delay(5000);
+    //MQTT connect task body: the blocking part of a connect (DNS lookup, TCP
+    //connect, CONNACK wait). Only runs while _mqttState is MQTT_CONNECTING,
+    //when loop() doesn't touch client; the result goes back through _mqttConnResult.
+    void mqttConnect() {
+        //Resolve the broker once; a failed lookup falls back to the name.
+        if (!_mqttIpResolved) {
+            IPAddress ip;
+            if (WiFi.hostByName(_mqtt_server, ip) == 1) {
+                client.setServer(ip, _mqtt_port);
+                _mqttIpResolved = true;
             }
         }
+        bool ok = client.connect(_mqtt_client_id);
+        if (ok) client.subscribe("ELEC520/security/#");
+        _mqttConnRc = client.state();
+        _mqttConnResult.store(ok ? MQTT_CONN_OK : MQTT_CONN_FAILED);
     }
 
 
+    //MQTT Reconnect state machine. Never waits on the broker: an attempt is
+    //handed to the connect task and picked up here on a later call. None are
+    //started while Wi-Fi is down or a backoff is pending. Returns true while connected.
+    bool brokerService() {
+        unsigned long now = millis();
+
+        if (_mqttState == MQTT_CONNECTING) {
+            uint8_t res = _mqttConnResult.exchange(MQTT_CONN_PENDING);
+            if (res == MQTT_CONN_PENDING) return false;
+            if (res == MQTT_CONN_OK) {
+                Serial.println("MQTT connected");
+                _mqttState = MQTT_CONNECTED;
+                _mqttFailStreak = 0;
+                _mqttBackoffMs = MQTT_BACKOFF_MIN_MS;
+                _mqttConnects++;
+                _mqttPub.reset();   //Refresh every retained topic.
+                return true;
+            }
+            mqttBackoff(_mqttConnRc);
+            return false;
+        }
+
+        if (client.connected()) {
+            if (_mqttState != MQTT_CONNECTED) _mqttState = MQTT_CONNECTED;
+            return true;
+        }
+
+        if (_mqttState == MQTT_CONNECTED) {
+            //Link dropped: first retry straight away.
+            Serial.printf("MQTT connection lost, rc=%d\n", client.state());
+            _mqttState = MQTT_BACKOFF;
+            _mqttBackoffMs = MQTT_BACKOFF_MIN_MS;
+            _mqttRetryAtMs = now;
+        }
+
+        if (!_wifiReady) {
+            _mqttState = MQTT_WAIT_WIFI;
+            return false;
+        }
+        if (_mqttState == MQTT_BACKOFF && (long)(now - _mqttRetryAtMs) < 0) return false;
 
+        _mqttAttempts++;
+        if (!_mqttTask && xTaskCreate(mqttConnectTaskStatic, "mqtt_connect", MQTT_TASK_STACK, this, 1, &_mqttTask) != pdPASS) {
+            _mqttTask = nullptr;
+            Serial.println("MQTT connect task failed to start");
+            mqttBackoff(client.state());
+            return false;
+        }
+        Serial.printf("Attempting MQTT connection (#%u)...\n", (unsigned)_mqttAttempts);
+        _mqttState = MQTT_CONNECTING;
+        xTaskNotifyGive(_mqttTask);
+        return false;
+    }
+
+    //Failed attempt: exponential backoff with jitter, waiting between half and
+    //all of the current backoff so nodes that lost the broker together don't
+    //retry together.
+    void mqttBackoff(int rc) {
+        _mqttFailStreak++;
+        uint32_t wait = _mqttBackoffMs / 2 + (uint32_t)random((long)(_mqttBackoffMs / 2) + 1);
+        _mqttRetryAtMs = millis() + wait;
+        _mqttBackoffMs = (_mqttBackoffMs >= MQTT_BACKOFF_MAX_MS / 2) ? MQTT_BACKOFF_MAX_MS : _mqttBackoffMs * 2;
+        _mqttState = MQTT_BACKOFF;
+        Serial.printf("MQTT connect failed, rc=%d. retry in %ums\n", rc, (unsigned)wait);
+    }
 
 
-    //Set up the wifi with the cloud. 
+        //Set up the wifi with the cloud. Starts the STA association and returns;
+    //onWifiEvent() tracks the link and brokerService() connects MQTT once an IP is up.
     void setup_wifi() {
-        delay(10);
-        Serial.printf("Connecting to %s\n", _ssid);
+        Serial.printf("Connecting to %s (in background)\n", _ssid);
+        WiFi.mode(WIFI_STA);
+        WiFi.onEvent(wifiEventStatic);
+        WiFi.setAutoReconnect(true);
         WiFi.begin(_ssid, _password);
-        while (WiFi.status() != WL_CONNECTED) {
-            delay(500);
-            Serial.print(".");
-        }
-        Serial.printf("\nWiFi connected, IP: %s\n", WiFi.localIP().toString().c_str());
 
         client.setServer(_mqtt_server, _mqtt_port);
         client.setCallback(mqttCallbackStatic);
+        client.setBufferSize(MQTT_BUFFER_SIZE);
+        //Short timeouts: a dead broker costs the connect task seconds, not
+        //minutes, and a stalled socket can't hold up a publish in loop() for long.
+        client.setSocketTimeout(MQTT_SOCKET_TIMEOUT_S);
+        espClient.setTimeout(MQTT_CONNECT_TIMEOUT_MS);   //ms in core 3.x
+        espClient.setConnectionTimeout(MQTT_CONNECT_TIMEOUT_MS);
+    }
+
+
+    //WIFI event handler (Wi-Fi event task): flags only, no blocking work,
+    //no Serial and no Strings. reportWifi() prints from loop().
+    void onWifiEvent(arduino_event_id_t event, arduino_event_info_t info) {
+        switch (event) {
+            case ARDUINO_EVENT_WIFI_STA_GOT_IP:
+                _wifiIp = info.got_ip.ip_info.ip.addr;
+                _wifiIpMs = millis();
+                if (_wifiUpMs == 0) _wifiUpMs = _wifiIpMs;
+                _wifiReady = true;
+                _wifiLog.fetch_or(WIFI_LOG_UP);
+                break;
+            case ARDUINO_EVENT_WIFI_STA_DISCONNECTED:
+            case ARDUINO_EVENT_WIFI_STA_LOST_IP:
+                if (_wifiReady) _wifiLog.fetch_or(WIFI_LOG_DOWN);
+                _wifiReady = false;
+                break;
+            default:
+                break;
+        }
     }
 
 
@@ -205,7 +477,7 @@ private:
         esp_now_register_recv_cb(onReceiveStatic);
 
         memset(peerInfo.peer_addr, 0xFF, 6);
-        peerInfo.channel = WiFi.channel();
+        peerInfo.channel = 0;   //0 = follow the STA's current channel, which moves once it associates.
         peerInfo.encrypt = false;
         if (esp_now_add_peer(&peerInfo) != ESP_OK) {
             Serial.println("Failed to add peer");
@@ -237,35 +509,130 @@ private:
     // }
     
 
-    //ESP send callback. 
+    //ESP send callback (Wi-Fi task). Only records the result; processTransmit()
+    //picks it up and moves the queue on. Callbacks come in send order, one per
+    //accepted esp_now_send(), so the count says which send this one is for.
     void onESPSent(const wifi_tx_info_t *mac_addr, esp_now_send_status_t status) {
+        _txDoneUs = micros();
+        _txOk = (status == ESP_NOW_SEND_SUCCESS);
+        _txCallbacks.fetch_add(1);
+    }
+
+
+    //Finish the in-flight attempt: counters and log, then either pop the
+    //frame or leave it queued for a retry after an exponential backoff.
+    //sent is false when esp_now_send() refused the frame (no callback, no latency).
+    void completeTx(bool ok, bool timedOut, bool sent = true) {
+        EspTxFrame* f = _txFrame;
+        if (timedOut) _txTimeouts++;
+        else if (sent) {
+            _txLatencyUs = (uint32_t)(_txDoneUs - _txSentUs);
+            if (_txLatencyUs > _txLatencyMaxUs) _txLatencyMaxUs = _txLatencyUs;
+        }
+        if (ok) _txSent++; else _txFailed++;
+
+        EspPeer* p = f ? _peers.find(f->dst) : nullptr;
+        if (p) {
+            p->txFrames++;
+            if (ok) p->txFailStreak = 0;
+            else { p->txFailed++; if (p->txFailStreak < 255) p->txFailStreak++; }
+        }
+
         Serial.printf("TX: ");
         for (int i = 0; i < 6; i++) {
             Serial.printf("%02X", strucTXMessage.src_addr[i]);
             if (i < 5) Serial.print(":");
         }
-        Serial.printf(" | Value: %s\n", strucTXMessage.payload);
+        //Binary frame headers (0xA?, 0xB?) are never printable.
+        const uint8_t* body = f ? f->data : nullptr;
+        int bodyLen = f ? f->len : 0;
+        if (f && f->data[0] == ESP_SEQ_HDR) {
+            Serial.printf(" | #%u", (unsigned)f->data[1]);
+            body += ESP_SEQ_LEN; bodyLen -= ESP_SEQ_LEN;
+        }
+        if (f && f->tries)                       Serial.printf(" | retry %u", (unsigned)f->tries);
+        if (f && body[0] >= 0x80)                Serial.printf(" | Frame: %u bytes", (unsigned)f->len);
+        else if (f)                              Serial.printf(" | Value: %.*s", bodyLen, (const char*)body);
+        if (timedOut)   Serial.printf(" | no callback\n");
+        else if (!sent) Serial.printf(" | not sent\n");
+        else            Serial.printf(" | %s in %uus\n", ok ? "ok" : "FAIL", (unsigned)_txLatencyUs);
+
+        _txInFlight = false;
+        _txIdleSinceMs = millis();
+        if (!f) return;
+
+        //Only sequenced and alarm frames are retried (receivers drop the
+        //duplicate if the data got through but the ACK didn't; an alarm repeat
+        //is harmless). A peer that has stopped answering gets a single attempt
+        //per frame until it ACKs again.
+        bool retryable = (f->data[0] == ESP_SEQ_HDR || _txFromAlarm) && !(p && p->txFailStreak > ESP_TX_MAX_RETRIES);
+        if (!ok && retryable && f->tries < ESP_TX_MAX_RETRIES) {
+            uint32_t wait = (uint32_t)ESP_TX_BACKOFF_MIN_MS << f->tries;
+            if (wait > ESP_TX_BACKOFF_MAX_MS) wait = ESP_TX_BACKOFF_MAX_MS;
+            f->tries++;
+            f->retryAtMs = millis() + wait;
+            _txRetries++;
+            return;
+        }
+
+        if (ok) { _txDelivered++; _txRetryDepth[f->tries]++; }
+        else    _txGaveUp++;
+        if (_txFromAlarm) {
+            if (ok) {
+                _alarmEspUs = (uint32_t)(_txDoneUs - f->stampUs);
+                if (_alarmEspUs > _alarmEspMaxUs) _alarmEspMaxUs = _alarmEspUs;
+                Serial.printf("ALARM: ESP-NOW out %uus after detection\n", (unsigned)_alarmEspUs);
+            }
+            _alarmTxQueue.remove(f);
+        }
+        else _txQueue.remove(f);
     }
 
 
-    //Esp now receive call back function. 
+    //Esp now receive call back function. Runs in the Wi-Fi task: copy the
+    //frame into the queue and return; parsing happens in processReceived().
     void onReceive(const esp_now_recv_info_t* info, const uint8_t* data, int len) {
-        // Create a null-terminated buffer
-        static char buf[251];
-        int n = (len < 250) ? len : 250;
-        memcpy(buf, data, n);
-        buf[n] = '\0';  // make it a valid string
+        int rssi = info->rx_ctrl ? info->rx_ctrl->rssi : 0;
+        _rxQueue.push(info->src_addr, rssi, data, len);
+    }
+
+
+    //Parse one queued frame into MODEL (loop() context).
+    void handleFrame(const EspRxFrame& f) {
+        EspPeer* peer = storePeerDetails(f.src, f.rssi, f.rxMs);
+
+        if (classTdmaScheduler::isBeacon(f.data, f.len)) {
+            _tdma.onBeacon(f.data, f.len, f.rxMs);
+            if (f.len > TDMA_BEACON_LEN && !_tdma.isMaster()) setSystemState(f.data[TDMA_BEACON_LEN]);
+            return;
+        }
+
+        const uint8_t* data = f.data;
+        size_t len = f.len;
+        uint8_t seq;
+        if (espSeqUnwrap(data, len, seq) && peer && !espPeerAcceptSeq(*peer, seq)) { _rxDuplicates++; return; }
+
+        //Binary frames: decode straight from the queue slot.
+        if (isRoomBatchFrame(data, len)) {
+            if (!parseRoomBatchFrame(data, len))
+                Serial.printf("RX: bad room batch (%u bytes)\n", (unsigned)len);
+            return;
+        }
+        if (isRoomEspFrame(data, len)) {
+            if (!parseRoomEspFrame(data, len))
+                Serial.printf("RX: bad room frame (%u bytes)\n", (unsigned)len);
+            return;
+        }
 
         Serial.print("RX: ");
         for (int i = 0; i < 6; i++) {
-            Serial.printf("%02X", info->src_addr[i]);
+            Serial.printf("%02X", f.src[i]);
             if (i < 5) Serial.print(":");
         }
-        Serial.printf(" | Value: %s\n", buf);
+        Serial.printf(" | RSSI: %d | Value: %s\n", f.rssi, (const char*)data);
 
-        String msg(buf);
-
-        parseRoomEspString(msg);
+        //One room, or several joined with '\n'.
+        parseRoomEspText((const char*)data, len);
     }
 
 
@@ -275,14 +642,51 @@ private:
         message.payload[sizeof(message.payload) - 1] = '\0';
         size_t len = strnlen(message.payload, sizeof(message.payload));
         
-        if (len == 0 || len > 250) {
+        if (len == 0 || len > ESP_SEQ_PAYLOAD_MAX) {
             Serial.printf("Invalid ESP-NOW payload length: %u\n", (unsigned)len);
             return;
         }
 
-        esp_err_t result = esp_now_send(peerInfo.peer_addr, (uint8_t*)message.payload, len);
-        if (result != ESP_OK)
-            Serial.printf("esp_now_send failed with error: %d\n", result);
+        sendEspNowRaw((const uint8_t*)message.payload, len);
+    }
+
+
+    //Queue a raw (possibly binary) esp now frame; processTransmit() sends it.
+    //Goes unicast to every known peer, or broadcast when none are known yet
+    //or when asked (beacons and full refreshes, so new nodes discover us).
+    //Each frame gets the next sequence number, shared by all its copies;
+    //beacons go out bare since they are stamped in place and never retried.
+    //With alarm set the copies go on the alarm queue, bare and stamped with
+    //the detection time; they overtake sequenced frames, and a repeat only
+    //rewrites the same room state. False if any copy didn't fit in the queue.
+    bool sendEspNowRaw(const uint8_t* data, size_t len, bool broadcast = false, const AlarmEvent* alarm = nullptr) {
+        bool beacon = classTdmaScheduler::isBeacon(data, len);
+        if (!beacon && len > ESP_SEQ_PAYLOAD_MAX) {
+            Serial.printf("ESP-NOW frame too long (%u bytes)\n", (unsigned)len);
+            return false;
+        }
+        uint8_t seq = (beacon || alarm) ? 0 : _txSeq++;
+        auto push = [&](const uint8_t* dst) {
+            if (alarm) {
+                if (!_alarmTxQueue.push(dst, data, len)) return false;
+                _alarmTxQueue.back()->stampUs = alarm->atUs;
+                return true;
+            }
+            return beacon ? _txQueue.push(dst, data, len) : _txQueue.pushSeq(dst, seq, data, len);
+        };
+
+        //An alarm reaches every floor or none: if a copy per peer no longer
+        //fits (several alarms at once), one broadcast copy carries it instead.
+        if (alarm && _alarmTxQueue.capacity() - _alarmTxQueue.pending() < _peers.count()) broadcast = true;
+
+        bool ok = true;
+        if (broadcast || _peers.count() == 0) ok = push(peerInfo.peer_addr);
+        else {
+            for (uint8_t i = 0; i < _peers.capacity(); i++)
+                if (EspPeer* p = _peers.at(i)) ok = push(p->mac) && ok;
+        }
+        if (!ok) Serial.printf("ESP-NOW TX queue full, frame dropped (%u bytes)\n", (unsigned)len);
+        return ok;
     }
 
 
@@ -319,11 +723,13 @@ public:
     void setNodeID(int iNodeID) { _iNodeID = iNodeID; }
     int getNodeID(){return _iNodeID; }
 
-    void setFloorID(byte id){_bFloorID = id;}
+    void setFloorID(byte id){_bFloorID = id; configureTdma();}
     byte getFloorID(){return _bFloorID;}
 
     //NETWORKING/////////////////////////////////////////////////////////////////////////////
     //Network setup. 
+    //Returns straight away: ESP-NOW is usable immediately, the AP association
+    //and MQTT connect complete in the background.
     void setupNetwork() {
         setup_wifi();
         setup_espnow();
@@ -332,6 +738,128 @@ public:
         //setBaseStation();
     }
 
+    //Drain up to maxFrames received ESP-NOW frames into MODEL. Call from loop().
+    //Returns the number parsed.
+    uint8_t processReceived(uint8_t maxFrames = ESP_RX_BATCH) {
+        uint8_t n = 0;
+        const EspRxFrame* f;
+        while (n < maxFrames && (f = _rxQueue.front()) != nullptr) {
+            handleFrame(*f);
+            _rxQueue.pop();
+            n++;
+        }
+        return n;
+    }
+
+    //Move the ESP-NOW send queue on. Call from loop(); never waits.
+    //One frame is in flight at a time; the next goes out _txGapMs after the
+    //previous send callback (or after ESP_TX_TIMEOUT_US if none arrives).
+    //A send that timed out still owes its callback; nothing else goes out until
+    //it turns up (and is dropped) or another ESP_TX_TIMEOUT_US passes, so a late
+    //callback is never credited to the next frame.
+    void processTransmit() {
+        if (_txInFlight) {
+            if (_txCallbacks.load() != _txCallbacksSeen) {
+                _txCallbacksSeen++;
+                completeTx(_txOk, false);
+            }
+            else if (micros() - _txSentUs > ESP_TX_TIMEOUT_US) {
+                completeTx(false, true);
+                _txLate = true;
+                _txLateSinceUs = micros();
+            }
+            else return;
+        }
+        if (_txLate) {
+            if (_txCallbacks.load() != _txCallbacksSeen) _txCallbacksSeen = _txCallbacks.load();
+            else if (micros() - _txLateSinceUs <= ESP_TX_TIMEOUT_US) return;
+            _txLate = false;
+        }
+
+        //Alarm frames go first and ignore the gap and the TDMA slot: they are
+        //rare, and a late alarm costs more than the odd collision. Frames
+        //backing off after a failed send are stepped over (nextReady()).
+        unsigned long now = millis();
+        EspTxFrame* f = _alarmTxQueue.nextReady(now);
+        bool alarm = f != nullptr;
+        if (!alarm) {
+            if (now - _txIdleSinceMs < _txGapMs || !_tdma.inTxWindow(now)) return;
+            f = _txQueue.nextReady(now);
+        }
+        if (!f) return;
+        _txFromAlarm = alarm;
+        _txFrame = f;
+        if (classTdmaScheduler::isBeacon(f->data, f->len)) _tdma.stampBeacon(f->data, millis());
+
+        _txInFlight = true;
+        _txSentUs = micros();
+        esp_err_t result = esp_now_send(f->dst, f->data, f->len);
+        if (result != ESP_OK) {
+            Serial.printf("esp_now_send failed with error: %d\n", result);
+            completeTx(false, false, false);
+        }
+    }
+
+    //Minimum gap between ESP-NOW sends.
+    void setEspTxGapMs(uint16_t ms) { _txGapMs = ms; }
+
+    //Send queue counters. sent/failed count attempts; delivered/gave-up count
+    //frames, and the retry depth says how many attempts delivered frames needed.
+    uint32_t getTxPending()   { return _txQueue.pending(); }
+    uint32_t getTxLatencyUs() { return _txLatencyUs; }
+    uint32_t getTxDelivered() { return _txDelivered; }
+    uint32_t getTxGaveUp()    { return _txGaveUp; }
+    uint32_t getTxRetries()   { return _txRetries; }
+    uint32_t getTxRetryDepth(uint8_t retries) { return retries <= ESP_TX_MAX_RETRIES ? _txRetryDepth[retries] : 0; }
+    uint32_t getRxDuplicates() { return _rxDuplicates; }
+
+    void printTxStats() {
+        Serial.printf("ESP-NOW TX: %u sent, %u failed, %u no-callback, %u pending, %u dropped, high-water %u/%u, latency %uus (max %uus)\n",
+                      (unsigned)_txSent, (unsigned)_txFailed, (unsigned)_txTimeouts,
+                      (unsigned)_txQueue.pending(), (unsigned)_txQueue.dropped(),
+                      (unsigned)_txQueue.highWater(), (unsigned)_txQueue.capacity(),
+                      (unsigned)_txLatencyUs, (unsigned)_txLatencyMaxUs);
+        uint32_t done = _txDelivered + _txGaveUp;
+        Serial.printf("ESP-NOW delivery: %u/%u frames (%u%%), %u retries, %u gave up, depth",
+                      (unsigned)_txDelivered, (unsigned)done,
+                      done ? (unsigned)(100u * _txDelivered / done) : 100u,
+                      (unsigned)_txRetries, (unsigned)_txGaveUp);
+        for (uint8_t i = 0; i <= ESP_TX_MAX_RETRIES; i++) Serial.printf(" %u", (unsigned)_txRetryDepth[i]);
+        Serial.printf(", %u duplicates dropped\n", (unsigned)_rxDuplicates);
+    }
+
+    //Per-peer link statistics. Loss = unicast attempts without a MAC-level ACK;
+    //gap/dup = sequence numbers skipped / repeated in frames from the peer.
+    void printPeerStats() {
+        Serial.printf("ESP-NOW peers: %u/%u\n", (unsigned)_peers.count(), (unsigned)_peers.capacity());
+        for (uint8_t i = 0; i < _peers.capacity(); i++) {
+            EspPeer* p = _peers.at(i);
+            if (!p) continue;
+            unsigned lossPct = p->txFrames ? (unsigned)(100u * p->txFailed / p->txFrames) : 0;
+            Serial.printf("  %02X:%02X:%02X:%02X:%02X:%02X rssi %d (avg %d), seen %lums ago, rx %u (gap %u, dup %u), tx %u, lost %u (%u%%)\n",
+                          p->mac[0], p->mac[1], p->mac[2], p->mac[3], p->mac[4], p->mac[5],
+                          p->rssi, p->rssiAvg, (unsigned long)(millis() - p->lastSeenMs),
+                          (unsigned)p->rxFrames, (unsigned)p->rxLost, (unsigned)p->rxDup,
+                          (unsigned)p->txFrames, (unsigned)p->txFailed, lossPct);
+        }
+    }
+
+    //Receive queue counters.
+    uint32_t getRxPending()   { return _rxQueue.pending(); }
+    uint32_t getRxDropped()   { return _rxQueue.dropped(); }
+    uint32_t getRxHighWater() { return _rxQueue.highWater(); }
+
+    void printRxStats() {
+        Serial.printf("ESP-NOW RX: %u received, %u pending, %u dropped, high-water %u/%u\n",
+                      (unsigned)_rxQueue.received(), (unsigned)_rxQueue.pending(),
+                      (unsigned)_rxQueue.dropped(), (unsigned)_rxQueue.highWater(),
+                      (unsigned)_rxQueue.capacity());
+    }
+
+    //Select the ESP-NOW room payload format (binary by default, text for debugging).
+    void setEspFormat(EspRoomFormat fmt){ _espFormat = fmt; }
+    EspRoomFormat getEspFormat(){ return _espFormat; }
+
     //Sets the number of rooms in the system. Used for sending the correct amount of esp now messages per floor. 
     void setNumberOfRooms(int number){
         _uiNumRoom = number;
@@ -339,74 +867,233 @@ public:
 
 
     //Send floor data over esp now
+    //Only rooms that changed since the last window are sent, except for a
+    //periodic full refresh so receivers that rebooted catch up. Rooms are
+    //packed into as few frames as fit (binary batch, or '\n'-joined text).
     void sendFloorData(){
+        bool full = !_fullEspSent || (millis() - _lastFullEspMs > FULL_REFRESH_MS);
+        if (full) { _lastFullEspMs = millis(); _fullEspSent = true; }
+
+        if (_espFormat == ESP_FMT_BINARY) sendFloorBatches(full);
+        else                              sendFloorText(full);
+    }
 
-        for (uint8_t i=1; i<_uiNumRoom+1; i++){
-            // Serial.printf("Room ID is %d\n", i);
-            String data = buildRoomEspString(getFloorID(), i);
-            //convert string to char[250];
-            data.toCharArray(strucTXMessage.payload, sizeof(strucTXMessage.payload));
-            strucTXMessage.payload[sizeof(strucTXMessage.payload) - 1] = '\0';
-            //Send the data over esp now. 
-            sendEspNowMsg(strucTXMessage);
-            delay(20);
+
+    //Binary: batch frames. A room is only marked clean once its frame is queued,
+    //so a full TX queue retries it next window.
+    void sendFloorBatches(bool full){
+        uint8_t* buf = (uint8_t*)strucTXMessage.payload;
+        const size_t cap = ESP_SEQ_PAYLOAD_MAX;
+        size_t len = beginRoomBatch(buf, cap);
+        EspRoomMask inFrame = 0;   //Rooms packed into buf.
+
+        for (uint8_t i=1; i<=lastRoom(); i++){
+            if (!full && !isRoomDirty(getFloorID(), i, SINK_ESP)) continue;
+            //Records carry no ts, so a ts-only change has nothing to send.
+            if (!full && !isRoomDataDirty(getFloorID(), i, SINK_ESP)) { clearRoomDirty(getFloorID(), i, SINK_ESP); continue; }
+
+            //Not in the model: nothing to send, and nothing to retry.
+            if (measureRoomRecord(getFloorID(), i) == 0) { clearRoomDirty(getFloorID(), i, SINK_ESP); continue; }
+
+            //From here 0 only means the room doesn't fit: send what we have.
+            size_t n = appendRoomToBatch(getFloorID(), i, buf, len, cap);
+            if (n == 0 && inFrame) {
+                flushBatch(buf, len, inFrame, full);
+                len = beginRoomBatch(buf, cap);
+                inFrame = 0;
+                n = appendRoomToBatch(getFloorID(), i, buf, len, cap);
+            }
+            if (n == 0) continue;
+            len = n;
+            inFrame |= (EspRoomMask)1 << i;
+        }
+        if (inFrame) flushBatch(buf, len, inFrame, full);
+    }
+
+    void flushBatch(const uint8_t* buf, size_t len, EspRoomMask rooms, bool broadcast){
+        if (!sendEspNowRaw(buf, len, broadcast)) return;
+        for (uint8_t r = 0; r < SMP_MAX_ROOMS; r++)
+            if (rooms & ((EspRoomMask)1 << r)) clearRoomDirty(getFloorID(), r, SINK_ESP);
+    }
+
+    //Highest room ID sent: setNumberOfRooms(), capped to what the model holds.
+    uint8_t lastRoom(){ return _uiNumRoom < SMP_MAX_ROOMS ? _uiNumRoom : SMP_MAX_ROOMS - 1; }
+
+
+    //Text (debug): room strings joined with '\n' up to a full frame. As with
+    //batches, a full refresh only marks rooms clean once their frame is queued.
+    //Deltas are taken (and cleared) as they are built, so if one can't be
+    //queued the next window is a full refresh instead.
+    void sendFloorText(bool full){
+        String frame;
+        EspRoomMask inFrame = 0;   //Rooms in frame.
+        for (uint8_t i=1; i<=lastRoom(); i++){
+            if (!full && !isRoomDirty(getFloorID(), i, SINK_ESP)) continue;
+            if (measureRoomRecord(getFloorID(), i) == 0) { clearRoomDirty(getFloorID(), i, SINK_ESP); continue; }
+
+            String data = full ? buildRoomEspString(getFloorID(), i)
+                               : buildRoomDeltaString(getFloorID(), i, SINK_ESP);
+            if (data.length() == 0) continue;
+
+            if (frame.length() && frame.length() + 1 + data.length() > ESP_SEQ_PAYLOAD_MAX) {
+                flushText(frame, inFrame, full);
+                frame = "";
+                inFrame = 0;
+            }
+            if (frame.length()) frame += '\n';
+            frame += data;
+            inFrame |= (EspRoomMask)1 << i;
+        }
+        if (frame.length()) flushText(frame, inFrame, full);
+    }
+
+    void flushText(const String& frame, EspRoomMask rooms, bool full){
+        if (!sendEspNowRaw((const uint8_t*)frame.c_str(), frame.length(), full)) {
+            if (!full) _fullEspSent = false;
+            return;
         }
+        if (!full) return;
+        for (uint8_t r = 0; r < SMP_MAX_ROOMS; r++)
+            if (rooms & ((EspRoomMask)1 << r)) clearRoomDirty(getFloorID(), r, SINK_ESP);
+    }
+
 
+    //Floor n transmits in TDMA slot n-1 of iNumOfFloors; floor 1 is the base station.
+    void configureTdma(){
+        uint8_t slot = (getFloorID() > 0) ? getFloorID() - 1 : 0;
+        _tdma.configure((uint8_t)iNumOfFloors, slot, getFloorID() == 1);
     }
 
 
-    //Transmit window 
+    //Transmit window. Call every loop(): the base station queues a beacon at
+    //each superframe start, and every floor queues its rooms when its slot
+    //opens. processTransmit() only sends inside the slot.
     void transmitWindow(){
-        //Trasnmit time interval. 
-        if(millis() - startTime > 1000){
-            //Increment the transmit window position. 
-            bTransmitPosition = (bTransmitPosition<<1);
-            //Roll over. 
-            if (bTransmitPosition == 0b0000'0000) bTransmitPosition = 0b0000'0001;
-            startTime = millis();
-            //If ID match, then send data.
-            if (getFloorID() == bTransmitPosition) {
-                sendFloorData();
-            } 
+        unsigned long now = millis();
+        _tdma.service(now);
+
+        if (_tdma.beaconDue(now)) {
+            uint8_t beacon[TDMA_BEACON_LEN + 1];
+            size_t n = _tdma.buildBeacon(beacon, sizeof(beacon));
+            if (n > 0) {
+                beacon[n++] = MODEL.systemState;   //Floors need it to flag alarms.
+                sendEspNowRaw(beacon, n, true);
+            }
+        }
+        if (_tdma.slotStarted(now)) sendFloorData();
+    }
+
+
+    //Alarm fast path. Call every loop(), after anything that parses sensor
+    //data. Each event flagged by the parsers (hall opened while ARMED) goes
+    //out straight away: an ESP-NOW frame for the room if it is on this floor,
+    //ahead of the queue and outside the slot, and an MQTT publish of the
+    //floor if the broker is connected. Normal pacing carries on after.
+    void serviceAlarms(){
+        AlarmEvent ev;
+        while (takeAlarmEvent(ev)) {
+            _alarmEvents++;
+            Serial.printf("ALARM: f%u r%u hall %u opened while armed\n", ev.f, ev.r, ev.h);
+
+            if (ev.f == getFloorID()) {
+                uint8_t buf[ESP_SEQ_PAYLOAD_MAX];
+                size_t len = beginRoomBatch(buf, sizeof(buf));
+                len = appendRoomToBatch(ev.f, ev.r, buf, len, sizeof(buf));
+                if (len) sendEspNowRaw(buf, len, false, &ev);
+            }
+
+            if (_mqttState == MQTT_CONNECTED && client.connected() && publishFloor(ev.f, millis(), true)) {
+                _alarmMqttUs = micros() - ev.atUs;
+                if (_alarmMqttUs > _alarmMqttMaxUs) _alarmMqttMaxUs = _alarmMqttUs;
+                Serial.printf("ALARM: MQTT out %uus after detection\n", (unsigned)_alarmMqttUs);
+            }
         }
+        //Get the frame on air now rather than on the next pass.
+        if (_alarmTxQueue.pending()) processTransmit();
+    }
+
+    void printAlarmStats() {
+        Serial.printf("Alarms: %u events (%u dropped), ESP-NOW %uus (max %uus), MQTT %uus (max %uus)\n",
+                      (unsigned)_alarmEvents, (unsigned)droppedAlarmEvents(),
+                      (unsigned)_alarmEspUs, (unsigned)_alarmEspMaxUs,
+                      (unsigned)_alarmMqttUs, (unsigned)_alarmMqttMaxUs);
+    }
+
+
+    //TDMA slot length and guard time (base station: these are sent in the beacon).
+    void setTdmaTiming(uint16_t slotMs, uint8_t guardMs){ _tdma.setTiming(slotMs, guardMs); }
+
+    void printTdmaStats() {
+        Serial.printf("TDMA: slot %u/%u, frame %ums, %s, %u beacons, last correction %ldms, %u sync losses\n",
+                      (unsigned)_tdma.getSlot() + 1, (unsigned)_tdma.getNumSlots(), (unsigned)_tdma.getFrameMs(),
+                      _tdma.isMaster() ? "master" : (_tdma.isSynced() ? "synced" : "free-running"),
+                      (unsigned)_tdma.getBeacons(), _tdma.getLastCorrection(), (unsigned)_tdma.getSyncLosses());
     }
 
 
     //MQTT loop
     void mqttOperate(){
-        if (!client.connected()) {
-            brokerReconnect();
-        }
+        reportWifi();
+        //Dirty flags are kept while offline, so changes go out after reconnect.
+        if (!brokerService()) return;
         client.loop();
 
-        // Example publish system status every 5 seconds
-        static unsigned long publishMsg = 0;
-        if (millis() - publishMsg > 5000) {
-            publishMsg = millis();
-            
-            //Publish to client. 
-            String topic;
-            String payload;
-
-            //Publish system data
-
-
-            //Publish floor data
-            for (int i=1; i<iNumOfFloors+1; i++){
-                topic = cloudTopicFloor(i);
-                // topic = "ELEC520/security";
-                payload = buildFloorMqttString(i);
-                client.publish(topic.c_str(), payload.c_str());
-                Serial.printf("MQTT Publish [%s]: %s\n", topic.c_str(), payload.c_str());
-                delay(20);
-            }
+        //Publish floor data as soon as it changes (rate-limited per topic),
+        //with a heartbeat while idle. Retained, so late subscribers get state at once.
+        unsigned long now = millis();
+        for (int i=1; i<iNumOfFloors+1; i++){
+            publishFloor(i, now);
         }
 
     }
 
 
+    //Print the link changes onWifiEvent() flagged. Loop context; mqttOperate()
+    //calls it, floors without MQTT call it directly.
+    void reportWifi() {
+        uint8_t log = _wifiLog.exchange(0);
+        if (!log) return;
+        if (log & WIFI_LOG_DOWN) Serial.println("WiFi link lost, reconnecting in background");
+        if ((log & WIFI_LOG_UP) && _wifiReady)
+            Serial.printf("WiFi connected, IP: %s (%lu ms after boot)\n",
+                          IPAddress(_wifiIp).toString().c_str(), (unsigned long)_wifiIpMs);
+    }
+
+    //Wi-Fi link state. getWifiUpMs() is millis() at the first IP, 0 until then.
+    bool isWifiReady() { return _wifiReady; }
+    unsigned long getWifiUpMs() { return _wifiUpMs; }
+
+    //MQTT link state and counters.
+    MqttLinkState getMqttState() { return _mqttState; }
+    uint32_t getMqttAttempts()   { return _mqttAttempts; }
+    uint32_t getMqttFailStreak() { return _mqttFailStreak; }
+    uint32_t getMqttConnects()   { return _mqttConnects; }
+
+    //Publish policy: minimum gap between publishes on a floor topic (all
+    //floors, or one), and the idle heartbeat.
+    void setMqttMinIntervalMs(uint16_t ms)                { _mqttPub.setMinIntervalMs(ms); }
+    void setMqttMinIntervalMs(uint8_t f_id, uint16_t ms)  { _mqttPub.setMinIntervalMs(f_id, ms); }
+    void setMqttHeartbeatMs(uint32_t ms)                  { _mqttPub.setHeartbeatMs(ms); }
+    const MqttTopicState* getMqttTopic(uint8_t f_id)      { return _mqttPub.topic(f_id); }
+
+    void printMqttStats() {
+        static const char* const names[] = { "WAIT_WIFI", "BACKOFF", "CONNECTED", "CONNECTING" };
+        Serial.printf("MQTT: %s, %u attempts, %u connects, %u failing in a row\n",
+                      names[_mqttState], (unsigned)_mqttAttempts,
+                      (unsigned)_mqttConnects, (unsigned)_mqttFailStreak);
+        for (int i=1; i<iNumOfFloors+1; i++){
+            const MqttTopicState* t = _mqttPub.topic(i);
+            if (!t || !t->sent) continue;
+            Serial.printf("  %s: %u published (%u heartbeat, %u alarm), %u unchanged skipped, last %u bytes %lums ago\n",
+                          cloudTopicFloor(i), (unsigned)t->published, (unsigned)t->heartbeats, (unsigned)t->alarms,
+                          (unsigned)t->unchanged, (unsigned)t->len, (unsigned long)(millis() - t->lastMs));
+        }
+    }
+
+
     void setNumOfFloors(int value){
         iNumOfFloors = value;
+        configureTdma();
     }
 
 };
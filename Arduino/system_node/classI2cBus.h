@@ -0,0 +1,172 @@
+#ifndef CLASS_I2C_BUS
+#define CLASS_I2C_BUS
+
+#include <cstdint>
+#include <Arduino.h>
+#include <Wire.h>
+
+#define I2C_ADDR_MIN      0x12  //Nano addresses, 0x12 = room 1.
+#define I2C_ADDR_MAX      0x20
+#define I2C_NUM_ADDR      (I2C_ADDR_MAX - I2C_ADDR_MIN + 1)
+#define I2C_SCAN_STEP_MS  200   //Background scan: one absent address probed this often.
+#define I2C_MAX_MISSES    5     //Failed reads in a row before a device counts as gone.
+#define I2C_SLOW_POLL_MS  250   //Devices with a data-ready line: background read period.
+
+//One address on the bus.
+struct I2cDevice {
+    bool     present;
+    int8_t   readyPin;          //Own data-ready line, -1 if none.
+    uint8_t  misses;            //Failed reads in a row.
+    unsigned long lastPollMs;   //millis() of the last read.
+    uint32_t cycleMs;           //Time between the last two reads...
+    uint32_t cycleAvgMs;        //...smoothed, 1/8 weight per read.
+    uint32_t polls;
+    uint32_t errors;            //Reads with no valid frame (nothing, bad length or CRC).
+    uint8_t  lastSeq;           //Frame sequence number last read...
+    bool     seqValid;
+    uint32_t skipped;           //...and frames the Nano built that were never read.
+    uint32_t readyReads;        //Reads triggered by the data-ready line.
+};
+
+//Keeps the list of Nanos that answer, so loop() only polls those.
+//scan() probes every address once (at boot); after that service() probes one
+//absent address per I2C_SCAN_STEP_MS in the background, and a device that
+//stops answering drops out after I2C_MAX_MISSES reads until it is found again.
+//
+//Optional data-ready lines (open drain, active low, pulled up here): a Nano
+//pulls its line, or a line shared by several, low when it has a change.
+//Devices with a line asserted are read first; devices with a line are
+//otherwise only read every I2C_SLOW_POLL_MS. Devices without one are polled
+//continuously as before.
+class classI2cBus {
+private:
+    TwoWire& _wire;
+    I2cDevice _dev[I2C_NUM_ADDR] = {};
+    uint8_t _next = 0;           //Round-robin position over present devices.
+    uint8_t _scanPos = 0;        //Background scan position.
+    unsigned long _lastScanMs = 0;
+    uint32_t _found = 0, _lost = 0;
+    int8_t _sharedPin = -1;      //Data-ready line shared by every device, -1 if none.
+
+    bool probe(uint8_t addr) {
+        _wire.beginTransmission(addr);
+        return _wire.endTransmission(true) == 0;
+    }
+
+    void setPresent(uint8_t i, bool present) {
+        if (_dev[i].present == present) return;
+        _dev[i].present = present;
+        _dev[i].misses = 0;
+        if (present) _found++; else _lost++;
+        Serial.printf("I2C 0x%02X %s\n", I2C_ADDR_MIN + i, present ? "found" : "lost");
+    }
+
+    int8_t readyPinOf(uint8_t i) const { return _dev[i].readyPin >= 0 ? _dev[i].readyPin : _sharedPin; }
+    bool   isReady(uint8_t i)    const { int8_t p = readyPinOf(i); return p >= 0 && digitalRead(p) == LOW; }
+
+    //Next present device, round-robin from _next, that passes want(i).
+    template <typename F>
+    int pick(F want) {
+        for (uint8_t n = 0; n < I2C_NUM_ADDR; n++) {
+            uint8_t i = (_next + n) % I2C_NUM_ADDR;
+            if (_dev[i].present && want(i)) { _next = (i + 1) % I2C_NUM_ADDR; return i; }
+        }
+        return -1;
+    }
+
+public:
+    explicit classI2cBus(TwoWire& wire) : _wire(wire) {
+        for (uint8_t i = 0; i < I2C_NUM_ADDR; i++) _dev[i].readyPin = -1;
+    }
+
+    //Data-ready line for one device, or one shared by all.
+    void setReadyPin(uint8_t addr, int8_t pin) {
+        if (addr < I2C_ADDR_MIN || addr > I2C_ADDR_MAX) return;
+        _dev[addr - I2C_ADDR_MIN].readyPin = pin;
+        if (pin >= 0) pinMode(pin, INPUT_PULLUP);
+    }
+    void setSharedReadyPin(int8_t pin) {
+        _sharedPin = pin;
+        if (pin >= 0) pinMode(pin, INPUT_PULLUP);
+    }
+
+    //Probe every address. Blocking; call once from setup().
+    uint8_t scan() {
+        for (uint8_t i = 0; i < I2C_NUM_ADDR; i++) setPresent(i, probe(I2C_ADDR_MIN + i));
+        _lastScanMs = millis();
+        return count();
+    }
+
+    //Background rediscovery. Call every loop(); at most one probe per call.
+    void service(unsigned long now) {
+        if (now - _lastScanMs < I2C_SCAN_STEP_MS) return;
+        _lastScanMs = now;
+        for (uint8_t n = 0; n < I2C_NUM_ADDR; n++) {
+            uint8_t i = _scanPos;
+            _scanPos = (_scanPos + 1) % I2C_NUM_ADDR;
+            if (_dev[i].present) continue;
+            if (probe(I2C_ADDR_MIN + i)) setPresent(i, true);
+            return;
+        }
+    }
+
+    //Device to read now; 0 when none is due. Flagged devices first, then
+    //round-robin over devices without a line and those due a slow read.
+    uint8_t next(unsigned long now) {
+        int i = pick([&](uint8_t d) { return isReady(d); });
+        if (i >= 0) { _dev[i].readyReads++; return I2C_ADDR_MIN + i; }
+        i = pick([&](uint8_t d) {
+            return readyPinOf(d) < 0 || !_dev[d].polls || now - _dev[d].lastPollMs >= I2C_SLOW_POLL_MS;
+        });
+        return i >= 0 ? I2C_ADDR_MIN + i : 0;
+    }
+
+    //Result of reading addr; updates cycle time and drops dead devices.
+    void polled(uint8_t addr, bool ok, unsigned long now) {
+        if (addr < I2C_ADDR_MIN || addr > I2C_ADDR_MAX) return;
+        I2cDevice& d = _dev[addr - I2C_ADDR_MIN];
+        if (d.polls) {
+            d.cycleMs = now - d.lastPollMs;
+            d.cycleAvgMs = d.cycleAvgMs ? d.cycleAvgMs + ((int32_t)d.cycleMs - (int32_t)d.cycleAvgMs) / 8 : d.cycleMs;
+        }
+        d.lastPollMs = now;
+        d.polls++;
+        if (ok) { d.misses = 0; return; }
+        d.errors++;
+        if (++d.misses >= I2C_MAX_MISSES) setPresent(addr - I2C_ADDR_MIN, false);
+    }
+
+    //Sequence number of a valid frame from addr.
+    void frameSeq(uint8_t addr, uint8_t seq) {
+        if (addr < I2C_ADDR_MIN || addr > I2C_ADDR_MAX) return;
+        I2cDevice& d = _dev[addr - I2C_ADDR_MIN];
+        uint8_t gap = (uint8_t)(seq - d.lastSeq);
+        if (d.seqValid && gap > 1 && gap < 128) d.skipped += gap - 1;
+        d.lastSeq = seq;
+        d.seqValid = true;
+    }
+
+    uint8_t count() const {
+        uint8_t n = 0;
+        for (uint8_t i = 0; i < I2C_NUM_ADDR; i++) n += _dev[i].present;
+        return n;
+    }
+
+    const I2cDevice* device(uint8_t addr) const {
+        return (addr < I2C_ADDR_MIN || addr > I2C_ADDR_MAX) ? nullptr : &_dev[addr - I2C_ADDR_MIN];
+    }
+
+    void printStats() {
+        Serial.printf("I2C: %u devices, %u found, %u lost\n", (unsigned)count(), (unsigned)_found, (unsigned)_lost);
+        for (uint8_t i = 0; i < I2C_NUM_ADDR; i++) {
+            const I2cDevice& d = _dev[i];
+            if (!d.present && !d.polls) continue;
+            Serial.printf("  0x%02X %s: cycle %ums (avg %ums), %u polls (%u on data-ready), %u errors, %u frames skipped\n",
+                          I2C_ADDR_MIN + i, d.present ? "up" : "down",
+                          (unsigned)d.cycleMs, (unsigned)d.cycleAvgMs, (unsigned)d.polls,
+                          (unsigned)d.readyReads, (unsigned)d.errors, (unsigned)d.skipped);
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef CLASS_MQTT_PUBLISHER
+#define CLASS_MQTT_PUBLISHER
+
+#include <cstdint>
+#include <cstddef>
+#include <Arduino.h>
+
+#define MQTT_MIN_INTERVAL_MS 250     //Default shortest gap between publishes on one topic.
+#define MQTT_HEARTBEAT_MS    60000   //Republish an unchanged topic this often.
+
+//Why a topic is due.
+//MQTT_PUB_ALARM is never returned by due(); the alarm fast path forces it.
+enum MqttPublishReason : uint8_t { MQTT_PUB_NONE, MQTT_PUB_FIRST, MQTT_PUB_CHANGE, MQTT_PUB_HEARTBEAT, MQTT_PUB_ALARM };
+
+//Counts and hashes a payload as it is written, so a publish can be compared
+//with the last one without building it in RAM.
+class PayloadHash : public Print {
+public:
+    size_t write(uint8_t c) override { _h = (_h ^ c) * 16777619u; _len++; return 1; }
+    size_t write(const uint8_t* data, size_t len) override {
+        for (size_t i = 0; i < len; i++) write(data[i]);
+        return len;
+    }
+    uint32_t hash() const { return _h; }
+    size_t   length() const { return _len; }
+private:
+    uint32_t _h = 2166136261u;   //FNV-1a
+    size_t _len = 0;
+};
+
+//Last publish on one topic.
+struct MqttTopicState {
+    bool     sent;            //Published since the last (re)connect.
+    unsigned long lastMs;     //millis() of the last publish.
+    uint32_t hash;            //PayloadHash of the last publish...
+    uint16_t len;             //...and its length.
+    uint16_t minIntervalMs;
+    uint32_t published;       //Publishes, by reason below.
+    uint32_t heartbeats;
+    uint32_t alarms;
+    uint32_t unchanged;       //Changes that hashed the same as the last publish.
+};
+
+//Publish policy for N topics (indexed 0..N-1 by the caller):
+//publish on change, no more often than the topic's minimum interval, and
+//at least every heartbeat while nothing changes. The caller hashes the
+//payload and asks isRepeat() so a value that flipped back isn't resent.
+template <uint8_t N>
+class classMqttPublisher {
+private:
+    MqttTopicState _t[N] = {};
+    uint32_t _heartbeatMs = MQTT_HEARTBEAT_MS;
+
+public:
+    classMqttPublisher() { for (uint8_t i = 0; i < N; i++) _t[i].minIntervalMs = MQTT_MIN_INTERVAL_MS; }
+
+    void setMinIntervalMs(uint8_t t, uint16_t ms) { if (t < N) _t[t].minIntervalMs = ms; }
+    void setMinIntervalMs(uint16_t ms) { for (uint8_t i = 0; i < N; i++) _t[i].minIntervalMs = ms; }
+    void setHeartbeatMs(uint32_t ms)   { _heartbeatMs = ms; }
+
+    //Forget what was sent (e.g. after reconnecting) so every topic goes out again.
+    void reset() { for (uint8_t i = 0; i < N; i++) _t[i].sent = false; }
+
+    MqttPublishReason due(uint8_t t, bool changed, unsigned long now) const {
+        if (t >= N) return MQTT_PUB_NONE;
+        const MqttTopicState& s = _t[t];
+        if (!s.sent) return MQTT_PUB_FIRST;
+        unsigned long age = now - s.lastMs;
+        if (changed && age >= s.minIntervalMs) return MQTT_PUB_CHANGE;
+        if (age >= _heartbeatMs) return MQTT_PUB_HEARTBEAT;
+        return MQTT_PUB_NONE;
+    }
+
+    //True if the payload matches the last one published on t.
+    bool isRepeat(uint8_t t, const PayloadHash& p) {
+        if (t >= N || !_t[t].sent || _t[t].hash != p.hash() || _t[t].len != p.length()) return false;
+        _t[t].unchanged++;
+        return true;
+    }
+
+    void published(uint8_t t, MqttPublishReason why, const PayloadHash& p, unsigned long now) {
+        if (t >= N) return;
+        MqttTopicState& s = _t[t];
+        s.sent = true;
+        s.lastMs = now;
+        s.hash = p.hash();
+        s.len = (uint16_t)p.length();
+        s.published++;
+        if (why == MQTT_PUB_HEARTBEAT) s.heartbeats++;
+        if (why == MQTT_PUB_ALARM)     s.alarms++;
+    }
+
+    const MqttTopicState* topic(uint8_t t) const { return t < N ? &_t[t] : nullptr; }
+    uint32_t getHeartbeatMs() const { return _heartbeatMs; }
+    uint8_t  capacity()       const { return N; }
+};
+
+#endif
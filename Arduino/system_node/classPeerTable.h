@@ -0,0 +1,90 @@
+#ifndef CLASS_PEER_TABLE
+#define CLASS_PEER_TABLE
+
+#include <cstdint>
+#include <cstring>
+
+#define PEER_TABLE_LEN 16   //ESP-NOW allows 20 unencrypted peers; leave room for broadcast. Power of two.
+
+//One known ESP-NOW node.
+struct EspPeer {
+    uint8_t  mac[6];
+    bool     used;
+    int8_t   rssi;          //Last frame.
+    int8_t   rssiAvg;       //Smoothed, 1/8 weight per frame.
+    unsigned long lastSeenMs;
+    uint32_t rxFrames;
+    uint32_t txFrames;      //Unicast frames sent to this peer...
+    uint32_t txFailed;      //...and how many got no MAC-level ACK.
+    uint8_t  txFailStreak;  //Consecutive unacknowledged sends.
+    uint8_t  lastSeq;       //Last sequenced frame accepted from this peer.
+    bool     seqValid;
+    uint32_t rxLost;        //Sequence numbers skipped.
+    uint32_t rxDup;         //Retried frames dropped as already seen.
+};
+
+//Sequence check for a frame from p. A repeat of the last number is a
+//retry whose ACK got lost; a forward jump counts the skipped frames as
+//lost. Anything else (sender rebooted) just resyncs.
+inline bool espPeerAcceptSeq(EspPeer& p, uint8_t seq) {
+    if (p.seqValid) {
+        uint8_t gap = (uint8_t)(seq - p.lastSeq);
+        if (gap == 0) { p.rxDup++; return false; }
+        if (gap < 128) p.rxLost += gap - 1;
+    }
+    p.lastSeq = seq;
+    p.seqValid = true;
+    return true;
+}
+
+//Fixed-size open-addressing hash table keyed by the full 6-byte MAC.
+//Lookups hash the MAC and probe linearly, so they stay O(1) while the table
+//is not close to full. Entries are never removed.
+template <uint8_t N>
+class classPeerTable {
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "peer table length must be a power of two");
+
+private:
+    EspPeer _peers[N] = {};
+    uint8_t _count = 0;
+
+    static uint8_t hash(const uint8_t* mac) {
+        uint32_t h = 2166136261u;   //FNV-1a
+        for (int i = 0; i < 6; i++) { h ^= mac[i]; h *= 16777619u; }
+        return (uint8_t)(h & (N - 1));
+    }
+
+public:
+    EspPeer* find(const uint8_t* mac) {
+        for (uint8_t i = 0, s = hash(mac); i < N; i++, s = (s + 1) & (N - 1)) {
+            if (!_peers[s].used) return nullptr;
+            if (memcmp(_peers[s].mac, mac, 6) == 0) return &_peers[s];
+        }
+        return nullptr;
+    }
+
+    //Returns the existing or a new entry (added = true), nullptr when full.
+    EspPeer* findOrAdd(const uint8_t* mac, bool& added) {
+        added = false;
+        for (uint8_t i = 0, s = hash(mac); i < N; i++, s = (s + 1) & (N - 1)) {
+            EspPeer& p = _peers[s];
+            if (p.used && memcmp(p.mac, mac, 6) == 0) return &p;
+            if (p.used) continue;
+            memset(&p, 0, sizeof(p));
+            memcpy(p.mac, mac, 6);
+            p.used = true;
+            _count++;
+            added = true;
+            return &p;
+        }
+        return nullptr;
+    }
+
+    //Slot access for iteration: for (i < capacity()) if (EspPeer* p = at(i)) ...
+    EspPeer* at(uint8_t i) { return (i < N && _peers[i].used) ? &_peers[i] : nullptr; }
+
+    uint8_t count()    const { return _count; }
+    uint8_t capacity() const { return N; }
+};
+
+#endif
@@ -0,0 +1,163 @@
+#ifndef CLASS_TDMA_SCHEDULER
+#define CLASS_TDMA_SCHEDULER
+
+#include <cstdint>
+#include <cstddef>
+
+#define TDMA_SLOT_MS         100  //Default slot length.
+#define TDMA_GUARD_MS        10   //Default quiet time at each end of a slot.
+#define TDMA_SYNC_LOSS_FRAMES 4   //Superframes without a beacon before a node counts as unsynced.
+
+//Beacon frame, sent by the base station at the start of every superframe:
+//[hdr][seq][numSlots][slotMs lo][slotMs hi][guardMs][offsetMs lo][offsetMs hi]
+//offsetMs = time since the superframe started, stamped just before sending.
+//Bytes after these belong to the caller (classFloorNode adds the system state).
+#define TDMA_BEACON_HDR 0xC1
+#define TDMA_BEACON_LEN 8
+
+//Superframe = numSlots slots of slotMs; floor n owns slot n-1 and may only
+//transmit between guardMs after its slot starts and guardMs before it ends.
+//The base station's clock is the reference; other floors realign to each
+//beacon, and free-run on their own clock until the first one arrives.
+class classTdmaScheduler {
+private:
+    uint16_t _slotMs = TDMA_SLOT_MS;
+    uint8_t  _guardMs = TDMA_GUARD_MS;
+    uint8_t  _numSlots = 1;
+    uint8_t  _mySlot = 0;
+    uint8_t  _ownSlot = 0;             //Slot as configured, before wrapping to _numSlots.
+    bool     _master = false;
+
+    unsigned long _frameStartMs = 0;   //Local millis() at the current superframe start.
+    unsigned long _firedFrameMs = 0;   //Superframe whose slot start was already reported...
+    unsigned long _beaconFrameMs = 0;  //...and whose beacon was.
+    bool     _fired = false, _beaconed = false;
+    unsigned long _lastBeaconMs = 0;
+    bool     _synced = false;
+    uint8_t  _seq = 0;
+
+    uint32_t _beacons = 0;             //Beacons accepted.
+    uint32_t _syncLosses = 0;
+    long     _lastCorrectionMs = 0;    //Shift applied by the last beacon.
+
+    uint32_t frameMs() const { return (uint32_t)_numSlots * _slotMs; }
+
+    //Move _frameStartMs to the superframe containing now.
+    void advance(unsigned long now) {
+        uint32_t fm = frameMs();
+        if (now - _frameStartMs >= fm) _frameStartMs += ((now - _frameStartMs) / fm) * fm;
+    }
+
+    //True the first time it is called in each superframe. A beacon nudging
+    //_frameStartMs by less than half a frame doesn't count as a new one.
+    bool firstInFrame(unsigned long& marker, bool& seen) {
+        if (seen && (long)(_frameStartMs - marker) < (long)(frameMs() / 2)) return false;
+        marker = _frameStartMs;
+        seen = true;
+        return true;
+    }
+
+    static void put16(uint8_t* p, uint16_t v) { p[0] = (uint8_t)v; p[1] = (uint8_t)(v >> 8); }
+    static uint16_t get16(const uint8_t* p)   { return (uint16_t)(p[0] | (p[1] << 8)); }
+
+public:
+    //slot = 0-based slot this node owns; master = this node sends the beacon.
+    void configure(uint8_t numSlots, uint8_t slot, bool master) {
+        _numSlots = numSlots ? numSlots : 1;
+        _ownSlot = slot;
+        _mySlot = slot % _numSlots;
+        _master = master;
+        if (master) _synced = true;
+    }
+
+    //Guard is clamped so the usable window is never empty.
+    void setTiming(uint16_t slotMs, uint8_t guardMs) {
+        _slotMs = slotMs ? slotMs : 1;
+        _guardMs = (2u * guardMs < _slotMs) ? guardMs : (uint8_t)((_slotMs - 1) / 2);
+    }
+
+    //Call once per loop(). Drops sync if beacons stop.
+    void service(unsigned long now) {
+        advance(now);
+        if (!_master && _synced && now - _lastBeaconMs > TDMA_SYNC_LOSS_FRAMES * frameMs()) {
+            _synced = false;
+            _syncLosses++;
+        }
+    }
+
+    //True while now is inside this node's transmit window.
+    bool inTxWindow(unsigned long now) {
+        advance(now);
+        uint32_t off = now - _frameStartMs;
+        uint32_t start = (uint32_t)_mySlot * _slotMs + _guardMs;
+        uint32_t end   = (uint32_t)(_mySlot + 1) * _slotMs - _guardMs;
+        return off >= start && off < end;
+    }
+
+    //True once per superframe, on the first call inside this node's window.
+    bool slotStarted(unsigned long now) {
+        return inTxWindow(now) && firstInFrame(_firedFrameMs, _fired);
+    }
+
+    //Master only: true once per superframe, when a beacon should be queued.
+    bool beaconDue(unsigned long now) {
+        if (!_master) return false;
+        advance(now);
+        return firstInFrame(_beaconFrameMs, _beaconed);
+    }
+
+    size_t buildBeacon(uint8_t* buf, size_t cap) {
+        if (cap < TDMA_BEACON_LEN) return 0;
+        buf[0] = TDMA_BEACON_HDR;
+        buf[1] = _seq++;
+        buf[2] = _numSlots;
+        put16(buf + 3, _slotMs);
+        buf[5] = _guardMs;
+        put16(buf + 6, 0);
+        return TDMA_BEACON_LEN;
+    }
+
+    //Write the current superframe offset into a queued beacon right before it is sent.
+    void stampBeacon(uint8_t* buf, unsigned long now) {
+        advance(now);
+        put16(buf + 6, (uint16_t)(now - _frameStartMs));
+    }
+
+    static bool isBeacon(const uint8_t* data, size_t len) {
+        return data && len >= TDMA_BEACON_LEN && data[0] == TDMA_BEACON_HDR;
+    }
+
+    //Align to a beacon received at local time rxMs. Slot count and timing
+    //follow the base station so every floor runs the same superframe.
+    bool onBeacon(const uint8_t* data, size_t len, unsigned long rxMs) {
+        if (_master || !isBeacon(data, len)) return false;
+        _numSlots = data[2] ? data[2] : 1;
+        _mySlot = _ownSlot % _numSlots;
+        setTiming(get16(data + 3), data[5]);
+
+        unsigned long start = rxMs - get16(data + 6);
+        _lastCorrectionMs = (long)(start - _frameStartMs);
+        //The correction is only meaningful modulo a superframe.
+        long fm = (long)frameMs();
+        _lastCorrectionMs %= fm;
+        if (_lastCorrectionMs >  fm / 2) _lastCorrectionMs -= fm;
+        if (_lastCorrectionMs < -fm / 2) _lastCorrectionMs += fm;
+
+        _frameStartMs = start;
+        _lastBeaconMs = rxMs;
+        _synced = true;
+        _beacons++;
+        return true;
+    }
+
+    bool     isSynced()          const { return _synced; }
+    bool     isMaster()          const { return _master; }
+    uint32_t getFrameMs()        const { return frameMs(); }
+    uint32_t getBeacons()        const { return _beacons; }
+    uint32_t getSyncLosses()     const { return _syncLosses; }
+    long     getLastCorrection() const { return _lastCorrectionMs; }
+    uint8_t  getSlot()           const { return _mySlot; }
+    uint8_t  getNumSlots()       const { return _numSlots; }
+};
+
+#endif
@@ -1,23 +1,25 @@
-#include <elec520_nano.h>
 #include <elec520_protocol.h>
+#include <elec520_i2c.h>
 #include "classFloorNode.h"
+#include "classI2cBus.h"
 #include <Arduino.h>
 #include <Wire.h>
 #include <WString.h>
 
 #define SDA_PIN   21
 #define SCL_PIN   22
-#define ADDR_MIN  0x12
-#define ADDR_MAX  0x20
-#define NUM_ADDR  (ADDR_MAX - ADDR_MIN + 1)
-#define REQ_BYTES 30
-#define POLL_DELAY_MS 10
-
-static String rxBuf[NUM_ADDR];
-static String lastMsg[NUM_ADDR];
-
-static inline int idxFromAddr(uint8_t a){ return (a<ADDR_MIN||a>ADDR_MAX)?-1:(a-ADDR_MIN); }
-static inline bool isPrintableAscii(char c){ return c == '\n' || c == '\r' || (c >= 32 && c <= 126); }
+#define POLL_GAP_MS 5   //Minimum time between Nano reads (non-blocking).
+#define DRDY_PIN   -1   //Shared Nano data-ready line (open drain, active low); -1 = not wired.
+
+//Apply one validated Nano frame to MODEL.
+static bool applyReading(const I2cReading& rd){
+  switch (rd.type){
+    case I2C_T_CONN:  return setRoomConnected(rd.f, rd.r, rd.value != 0);
+    case I2C_T_ULTRA: return setUltraValue(rd.f, rd.r, rd.id, rd.value > 255 ? 255 : (uint8_t)rd.value);
+    case I2C_T_HALL:  return setHallOpen(rd.f, rd.r, rd.id, rd.value != 0);
+  }
+  return false;
+}
 
 const char* ssid = "Joe's S23 Ultra"; 
 const char* password = "joea12345"; 
@@ -26,9 +28,12 @@ int mqtt_port = 1883;
 const char* mqtt_client_id = "BaseStation";
 
 classFloorNode objFloor(ssid, password, mqtt_server, mqtt_port, mqtt_client_id);
+classI2cBus i2cBus(Wire);
 
 bool xCloudConnectionNode = false;
 
+unsigned long firstReadingMs = 0; //Boot to first parsed Nano line, 0 until then.
+
 int count = 0;
 
 
@@ -41,7 +46,8 @@ void setup() {
   Wire.begin(SDA_PIN, SCL_PIN); // 100 kHz
   Wire.setTimeOut(50);
 
-  Serial.println("ESP32 I2C master started. Polling 0x12..0x20");
+  if (DRDY_PIN >= 0) i2cBus.setSharedReadyPin(DRDY_PIN);
+  Serial.printf("ESP32 I2C master started. %u Nanos on 0x12..0x20\n", (unsigned)i2cBus.scan());
 
 
   //ESP setup
@@ -76,48 +82,37 @@ void setup() {
 
 //LOOP/////////////////////////////////////////////////////////////////////////////////////////
 void loop() {
-  static uint8_t addr = ADDR_MIN;
-
-  // quick probe
-  Wire.beginTransmission(addr);
-  uint8_t txStatus = Wire.endTransmission(true);
-  if (txStatus == 0){
-    // device ACKed; try to read
-    size_t got = Wire.requestFrom((int)addr, (int)REQ_BYTES, (int)true);
-    if (got > 0){
-      int idx = idxFromAddr(addr);
-      if (idx >= 0){
-        // read exactly 'got' bytes, filter non-printables
-        for (size_t i = 0; i < got; ++i){
-          char c = (char)Wire.read();
-          if (!isPrintableAscii(c)) continue;     // drop 0x00/0xFF/etc.
-          rxBuf[idx] += c;
-        }
-        // extract full lines ending with '\n'
-        for (;;){
-          int nl = rxBuf[idx].indexOf('\n');
-          if (nl < 0) break;
-          String line = rxBuf[idx].substring(0, nl);
-          rxBuf[idx].remove(0, nl + 1);
-
-          // sanity check: only accept our protocol lines
-          if (line.startsWith("f/")){
-            lastMsg[idx] = line;
-            Serial.println(line);
-            // parseRoomEspString(line); //protocol process
-            parseTokenLine(line);
-          }
-        }
+  // Read the next Nano that answered the last scan (ones pulling the
+  // data-ready line first); absent addresses are only probed by the background scan.
+  static unsigned long lastPollMs = 0;
+  i2cBus.service(millis());
+  uint8_t addr = (millis() - lastPollMs >= POLL_GAP_MS) ? i2cBus.next(millis()) : 0;
+  if (addr){
+    lastPollMs = millis();
+    // One request = one fixed-size frame, checked by length and CRC-8
+    uint8_t frame[I2C_FRAME_LEN];
+    size_t got = Wire.requestFrom((int)addr, (int)I2C_FRAME_LEN, (int)true);
+    for (size_t i = 0; i < got; ++i){
+      int c = Wire.read();
+      if (i < sizeof(frame)) frame[i] = (uint8_t)c;
+    }
+
+    I2cReading rd;
+    bool ok = i2cParseFrame(frame, got, rd);
+    i2cBus.polled(addr, ok, lastPollMs);
+    if (ok){
+      i2cBus.frameSeq(addr, rd.seq);
+      if (rd.type != I2C_T_NONE && applyReading(rd) && firstReadingMs == 0){
+        firstReadingMs = millis();
+        Serial.printf("Boot to first sensor reading: %lu ms (WiFi %s)\n", firstReadingMs,
+                      objFloor.isWifiReady() ? "up" : "still connecting");
       }
     }
+    else if (got > 0){
+      Serial.printf("I2C 0x%02X: bad frame (%u bytes)\n", addr, (unsigned)got);
+    }
   }
-  // Move to next address
-  addr++;
-  if (addr > ADDR_MAX) addr = ADDR_MIN;
 
-  // // Small delay so we’re not hammering the bus
-  delay(10);
-  
   // Test without I2C/////////////////////////////////////////
     // String nanoHallTest = nanoTokenHall(1, 1, 1, 1);
     // Serial.print(nanoHallTest);
@@ -125,17 +120,32 @@ void loop() {
     // parseTokenLine(nanoHallTest);
   /////////////////////////////////////////////////////////////
 
+  //Parse frames queued by the ESP-NOW receive callback
+  objFloor.processReceived();
+
+  //Hall opened while armed: send now, ahead of the schedule
+  objFloor.serviceAlarms();
+
   //gen esp string and sending over esp
   objFloor.transmitWindow();
+  objFloor.processTransmit();
 
   //Mqtt pub and sub
   if (objFloor.getFloorID() == 0b0000'0001) objFloor.mqttOperate();
+  else objFloor.reportWifi();
   
   count++;
   if (count > 500) {
     count = 0;
     //Spew everything onto the serial. 
     debugPrintModel(Serial);
+    objFloor.printRxStats();
+    objFloor.printTxStats();
+    objFloor.printTdmaStats();
+    objFloor.printPeerStats();
+    objFloor.printMqttStats();
+    objFloor.printAlarmStats();
+    i2cBus.printStats();
   }
 
 
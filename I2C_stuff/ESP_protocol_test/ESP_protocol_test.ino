@@ -1,25 +1,30 @@
 #include <Arduino.h>
 #include <Wire.h>
+#include <elec520_i2c.h>
 
 #define SDA_PIN   21
 #define SCL_PIN   22
 #define ADDR_MIN  0x12
 #define ADDR_MAX  0x20
 #define NUM_ADDR  (ADDR_MAX - ADDR_MIN + 1)
-#define REQ_BYTES 30
 #define POLL_DELAY_MS 10
 
-static String rxBuf[NUM_ADDR];
-static String lastMsg[NUM_ADDR];
+static I2cReading lastMsg[NUM_ADDR];
+static bool haveMsg[NUM_ADDR];
 
 static inline int idxFromAddr(uint8_t a){ return (a<ADDR_MIN||a>ADDR_MAX)?-1:(a-ADDR_MIN); }
-static inline bool isPrintableAscii(char c){ return c == '\n' || c == '\r' || (c >= 32 && c <= 126); }
+
+static void printReading(const I2cReading& rd){
+  static const char* const types[] = { "none", "cs", "u", "h" };
+  Serial.printf("#%u f/%u/r/%u/%s/%u:%u\n", rd.seq, rd.f, rd.r,
+                rd.type < 4 ? types[rd.type] : "?", rd.id, rd.value);
+}
 
 void setup(){
   Serial.begin(115200);
   Wire.begin(SDA_PIN, SCL_PIN);
   Wire.setTimeOut(50);
-  Serial.println("ESP32 I2C master: polling and buffering clean lines.");
+  Serial.println("ESP32 I2C master: polling binary frames.");
 }
 
 void loop(){
@@ -30,30 +35,20 @@ void loop(){
   uint8_t txStatus = Wire.endTransmission(true);
   if (txStatus == 0){
     // device ACKed; try to read
-    size_t got = Wire.requestFrom((int)addr, (int)REQ_BYTES, (int)true);
-    if (got > 0){
-      int idx = idxFromAddr(addr);
-      if (idx >= 0){
-        // read exactly 'got' bytes, filter non-printables
-        for (size_t i = 0; i < got; ++i){
-          char c = (char)Wire.read();
-          if (!isPrintableAscii(c)) continue;     // drop 0x00/0xFF/etc.
-          rxBuf[idx] += c;
-        }
-        // extract full lines ending with '\n'
-        for (;;){
-          int nl = rxBuf[idx].indexOf('\n');
-          if (nl < 0) break;
-          String line = rxBuf[idx].substring(0, nl);
-          rxBuf[idx].remove(0, nl + 1);
-
-          // sanity check: only accept our protocol lines
-          if (line.startsWith("f/")){
-            lastMsg[idx] = line;
-            Serial.println(line);
-          }
-        }
-      }
+    uint8_t frame[I2C_FRAME_LEN];
+    size_t got = Wire.requestFrom((int)addr, (int)I2C_FRAME_LEN, (int)true);
+    for (size_t i = 0; i < got; ++i){
+      int c = Wire.read();
+      if (i < sizeof(frame)) frame[i] = (uint8_t)c;
+    }
+    int idx = idxFromAddr(addr);
+    I2cReading rd;
+    if (idx >= 0 && i2cParseFrame(frame, got, rd)){
+      lastMsg[idx] = rd;
+      haveMsg[idx] = true;
+      printReading(rd);
+    } else if (got > 0){
+      Serial.printf("0x%02X: bad frame (%u bytes)\n", addr, (unsigned)got);
     }
   }
 
@@ -61,9 +56,9 @@ void loop(){
   static uint32_t tEcho = 0;
   if (millis() - tEcho > 1000){
     int i = idxFromAddr(0x12);
-    if (i >= 0 && lastMsg[i].length()){
+    if (i >= 0 && haveMsg[i]){
       Serial.print("[cached 0x12] ");
-      Serial.println(lastMsg[i]);
+      printReading(lastMsg[i]);
     }
     tEcho = millis();
   }
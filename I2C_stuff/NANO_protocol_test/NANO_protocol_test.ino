@@ -1,91 +1,159 @@
 // -------- NANO ULTRASONIC + HALL (I²C SLAVE) --------
 #include <Arduino.h>
 #include <Wire.h>
-#include "elec520_protocol_nano.h"   // Joes header
+#include <util/atomic.h>
+#include <elec520_i2c.h>            // binary I2C frame shared with the ESP32
+#include <elec520_ultrasonic.h>     // interrupt-driven HC-SR04 capture
+#include <elec520_filter.h>         // median / EMA / deadband on the distances
 
 // ====== USER PARAMETERS ======
 #define I2C_ADDR   0x12       // Nano adresses from 0x12 to 0x20
 #define FLOOR_ID    0x01       // set per room (hardcoded for now)
-#define ULTRA_ID   0x01       // one ultrasonic per node (for now)
 #define HALL_ID    0x01       // one hall per node (for now)
 
-// Ultrasonic pins HC-SR04
-#define TRIG_PIN   6
-#define ECHO_PIN   7
+// Ultrasonic pins HC-SR04, one pair per sensor; sensor n gets ID n+1.
+// Echo can be any pin (pin-change interrupt), up to ULTRA_MAX_SENSORS.
+static const uint8_t TRIG_PINS[] = { 6 };
+static const uint8_t ECHO_PINS[] = { 7 };
+#define NUM_ULTRA  (sizeof(TRIG_PINS) / sizeof(TRIG_PINS[0]))
 // Hall pin (active low when magnet present i cant remeber if this is the right way ask charlie?)
 #define HALL_PIN   4
+// Data-ready line to the ESP32 (optional, open drain, active low; one per Nano
+// or shared). Pulled low while a hall change or a big ultrasonic move is unread.
+#define DRDY_PIN   8
+#define ULTRA_NOTIFY_CM 10     // ultrasonic move (from the last value sent) that raises DRDY
+// Ultrasonic filter (same for every sensor). Send 'f' over serial to print the filter state.
+#define ULTRA_MEDIAN_N    5    // median of the last N readings, 1 = off
+#define ULTRA_EMA_SHIFT   2    // EMA weight 1/2^k per reading, 0 = off
+#define ULTRA_DEADBAND_CM 2    // reported value holds until the EMA moves further than this
 
 // ====== INTERNAL ======
 static uint8_t ROOM_ID;               // derived from I2C address
-static volatile bool haveLine = false; // when line is ready
-static String outLine;                 // the current line
+// Frame hand-off: loop() builds outFrame (interrupts off) and sets haveFrame;
+// the request ISR only copies it out and sets frameTaken. Everything else is
+// loop() only.
+static uint8_t outFrame[I2C_FRAME_LEN];  // the current frame
+static volatile bool haveFrame = false;  // outFrame not read yet
+static volatile bool frameTaken = false; // the master read a new frame; loop() not caught up yet
+static uint8_t frameSeq = 0;             // counts frames built
 static bool sentConnectOnce = false;   // only send connection token once
-static bool sendUltraNext = true;      // alternate ultra/hall
+static uint8_t nextStream = 0;         // round-robin: ultra 0..NUM_ULTRA-1, then hall
 static uint32_t lastSenseMs = 0;
-static uint8_t lastUltraCm = 0;
+static uint8_t lastUltraCm[NUM_ULTRA];       // filtered, what gets sent
+static DistFilter ultraFilter[NUM_ULTRA];
 static uint8_t hallOpen01 = 1;         // 0=detected, 1=no magnet (right way?)
-
-//  ultrasonics: simple read (cap at 255 cm need to add some averaging to minimise the jitter)
-static uint8_t readUltrasonicCm() {
-  digitalWrite(TRIG_PIN, LOW); delayMicroseconds(3);
-  digitalWrite(TRIG_PIN, HIGH); delayMicroseconds(10);
-  digitalWrite(TRIG_PIN, LOW);
-  // pulseIn timeout ~ 30ms -> ~5m range in theory capped at 255cm anyway for the min
-  unsigned long echo = pulseIn(ECHO_PIN, HIGH, 30000UL);
-  if (echo == 0) return 255; // no echo
-  // distance cm = echo / 58 (approx)
-  unsigned long cm = echo / 58UL;
-  if (cm > 255UL) cm = 255UL;
-  return (uint8_t)cm;
+static bool hallPending = false;            // hall changed, not sent yet
+static uint8_t ultraPending = 0;            // bit n: sensor n moved past ULTRA_NOTIFY_CM, not sent yet
+static uint8_t sentUltraCm[NUM_ULTRA];      // last value sent per sensor
+static uint8_t outType = I2C_T_NONE;        // type, sensor index and value in outFrame
+static uint8_t outUltra = 0;
+static uint8_t outValue = 0;
+
+// Open drain: drive low to assert, float (input, no pull-up) to release
+static void assertReady()  { digitalWrite(DRDY_PIN, LOW); pinMode(DRDY_PIN, OUTPUT); }
+static void releaseReady() { pinMode(DRDY_PIN, INPUT); }
+
+static void prepareNextFrame();
+
+// The master read outFrame: clear what it carried, release DRDY once
+// nothing else is waiting.
+static void frameRead() {
+  bool taken;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { taken = frameTaken; frameTaken = false; }
+  if (!taken) return;
+  if (outType == I2C_T_HALL) hallPending = false;
+  if (outType == I2C_T_ULTRA) { ultraPending &= (uint8_t)~_BV(outUltra); sentUltraCm[outUltra] = outValue; }
+  if (!hallPending && !ultraPending) releaseReady();
 }
 
 static void refreshSensors() {
-  // 20 Hz max update rate
-  if (millis() - lastSenseMs < 50) return;
-  lastSenseMs = millis();
+  bool notify = false;
+
+  // Ultrasonics: triggers/collects in the background (no pulseIn), 255 = no echo.
+  // Raw readings go through the filter; only a change of its output counts.
+  ultraService();
+  for (uint8_t i = 0; i < NUM_ULTRA; i++) {
+    if (!ultraFresh(i) || !filterPush(ultraFilter[i], ultraCm(i))) continue;
+    lastUltraCm[i] = filterOut(ultraFilter[i]);
+    int moved = (int)lastUltraCm[i] - (int)sentUltraCm[i];
+    if ((moved >= ULTRA_NOTIFY_CM || moved <= -ULTRA_NOTIFY_CM) && !(ultraPending & _BV(i))) {
+      ultraPending |= _BV(i);
+      notify = true;
+    }
+  }
 
-  // Ultrasonic
-  lastUltraCm = readUltrasonicCm();
+  // Hall: 20 Hz max update rate
+  if (millis() - lastSenseMs >= 50) {
+    lastSenseMs = millis();
+    int raw = digitalRead(HALL_PIN);
+    uint8_t open01 = (raw == LOW) ? 0 : 1;
+    if (open01 != hallOpen01) { hallPending = true; notify = true; }
+    hallOpen01 = open01;
+  }
 
-  // Hall
-  int raw = digitalRead(HALL_PIN);
-  hallOpen01 = (raw == LOW) ? 0 : 1;
+  // Tell the master there is something worth reading now
+  if (notify) {
+    assertReady();
+    prepareNextFrame();
+  }
 }
 
-// Build line to send over I2C
-static void prepareNextLine() {
+// Build frame to send over I2C (loop() only)
+static void prepareNextFrame() {
+  frameRead();   // pending flags must reflect what was already read
+
+  I2cReading rd;
+  rd.f = FLOOR_ID;
+  rd.r = ROOM_ID;
+  int8_t ultra = -1;
+  bool stream = false;
   if (!sentConnectOnce) {
-    outLine = nanoTokenRoomConnection(FLOOR_ID, ROOM_ID, /*connected*/true);
-    sentConnectOnce = true;
+    rd.type = I2C_T_CONN; rd.id = 0; rd.value = 1;   // connected
+  } else if (hallPending) {
+    // changes first (hall, then ultra), else alternate ultra / hall
+    rd.type = I2C_T_HALL;  rd.id = HALL_ID;  rd.value = hallOpen01;
+  } else if (uint8_t pend = ultraPending & (uint8_t)(_BV(NUM_ULTRA) - 1)) {
+    // lowest pending sensor; bounded so a stray bit can't run past the table
+    for (uint8_t i = 0; i < NUM_ULTRA; i++) if (pend & _BV(i)) { ultra = i; break; }
   } else {
-    // ultra / hall
-    if (sendUltraNext) {
-      outLine = nanoTokenUltra(FLOOR_ID, ROOM_ID, ULTRA_ID, lastUltraCm);
-    } else {
-      outLine = nanoTokenHall(FLOOR_ID, ROOM_ID, HALL_ID, hallOpen01);
-    }
-    sendUltraNext = !sendUltraNext;
+    if (nextStream < NUM_ULTRA) ultra = nextStream;
+    else { rd.type = I2C_T_HALL; rd.id = HALL_ID; rd.value = hallOpen01; }
+    stream = true;
   }
-  haveLine = true;
+  if (ultra >= 0) { rd.type = I2C_T_ULTRA; rd.id = ultra + 1; rd.value = lastUltraCm[ultra]; }
+
+  // Built in place with interrupts off, so a request never sees half a frame.
+  // If the master read the old frame since frameRead() above, keep it as the
+  // one read and try again next pass.
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if (frameTaken) return;
+    rd.seq = frameSeq++;
+    i2cBuildFrame(rd, outFrame);
+    haveFrame = true;
+  }
+  if (rd.type == I2C_T_CONN) sentConnectOnce = true;
+  if (stream) nextStream = (nextStream + 1) % (NUM_ULTRA + 1);
+  outType = rd.type;
+  outUltra = (uint8_t)(ultra >= 0 ? ultra : 0);
+  outValue = (uint8_t)rd.value;
 }
 
-// I2C request handler master to ask for a line
+// I2C request handler (TWI interrupt): hands out the frame loop() prepared
+// and nothing else. Read again before a new one is ready, it resends it.
 static void onRequestHandler() {
-  if (!haveLine) {
-    // If nothing prepared build one
-    prepareNextLine();
-  }
-  // Ensure don't overflow the Wire TX buffer (32 bytes)
-  String payload = outLine + "\n";
-  const size_t N = min((size_t)payload.length(), (size_t)30); // leave margin
-  Wire.write((const uint8_t*)payload.c_str(), N);
-  haveLine = false; 
+  // One fixed-size frame, well inside the Wire TX buffer (32 bytes)
+  Wire.write(outFrame, I2C_FRAME_LEN);
+  if (haveFrame) { haveFrame = false; frameTaken = true; }
 }
 
 void setup() {
-  pinMode(TRIG_PIN, OUTPUT);
-  pinMode(ECHO_PIN, INPUT);
+  for (uint8_t i = 0; i < NUM_ULTRA; i++) {
+    ultraAdd(TRIG_PINS[i], ECHO_PINS[i]);
+    filterInit(ultraFilter[i], ULTRA_MEDIAN_N, ULTRA_EMA_SHIFT, ULTRA_DEADBAND_CM);
+    lastUltraCm[i] = sentUltraCm[i] = ULTRA_NO_ECHO;
+  }
   pinMode(HALL_PIN, INPUT_PULLUP);
+  releaseReady();
 
   Serial.begin(115200);
   delay(50);
@@ -100,21 +168,31 @@ void setup() {
   Serial.print("Nano up. I2C=0x"); Serial.print(I2C_ADDR, HEX);
   Serial.print(" Floor="); Serial.print(FLOOR_ID);
   Serial.print(" Room="); Serial.print(ROOM_ID);
-  Serial.print(" UltraID="); Serial.print(ULTRA_ID);
+  Serial.print(" Ultras="); Serial.print((int)NUM_ULTRA);
   Serial.print(" HallID="); Serial.println(HALL_ID);
 
-  // Prepare initial connection token (on first master request)
-  prepareNextLine();
+  // Prepare initial connection frame (on first master request)
+  prepareNextFrame();
 }
 
 void loop() {
-  // keep sensors fresh (contant polling)
+  // account for the last read, then keep sensors fresh (contant polling)
+  frameRead();
   refreshSensors();
 
-  // if no requests poll keep updating anyway so we allways have up to date values
+  // 'f' on serial: dump each ultrasonic filter for tuning
+  if (Serial.available() && Serial.read() == 'f') {
+    for (uint8_t i = 0; i < NUM_ULTRA; i++) {
+      Serial.print("U"); Serial.print(i + 1); Serial.print(": ");
+      filterPrint(ultraFilter[i], Serial);
+    }
+  }
+
+  // Next frame as soon as the last one was read; if no requests poll keep
+  // updating anyway so we allways have up to date values
   static uint32_t lastPrep = 0;
-  if (millis() - lastPrep > 150) { // 6–7 Hz per stream ish
-    prepareNextLine();
+  if (!haveFrame || millis() - lastPrep > 150) { // 6–7 Hz per stream ish
+    prepareNextFrame();
     lastPrep = millis();
   }
 }
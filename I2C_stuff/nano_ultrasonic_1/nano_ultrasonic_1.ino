@@ -1,5 +1,6 @@
 #include <Wire.h>
 #include <lite_header.h>
+#include <elec520_ultrasonic.h>  // interrupt-driven HC-SR04 capture (no pulseIn)
 #define I2C_ADDR  0x13 //change to slave adress you are uploading too (room 1 0x12 room 2 0x13)
 #define trigpin   6
 #define echopin   7
@@ -7,7 +8,7 @@
 volatile bool have_msg = false;
 char msg[16];
 uint8_t msg_len = 0;
-float duration, distance;
+float distance;
 
 void onRequestHandler() {
   uint8_t len = have_msg ? msg_len : 0;
@@ -27,19 +28,18 @@ void setup() {
   Wire.onRequest(onRequestHandler);
   pinMode(A4, INPUT); digitalWrite(A4, LOW);
   pinMode(A5, INPUT); digitalWrite(A5, LOW);
-  pinMode(trigpin, OUTPUT);
-  pinMode(echopin, INPUT);
+  ultraAdd(trigpin, echopin);
   Serial.begin(9600);
   
 }
 
 void loop() {
-  // Measure distance
-  digitalWrite(trigpin, LOW);  delayMicroseconds(2);
-  digitalWrite(trigpin, HIGH); delayMicroseconds(10);
-  digitalWrite(trigpin, LOW);
+  // Measure distance: triggers and times the echo in the background (30 ms
+  // timeout), so the loop and onRequestHandler are never held up
+  ultraService();
+  if (!ultraFresh(0)) return;
 
-  duration = pulseIn(echopin, HIGH, 30000UL); // 30 ms timeouy improves reliability (can push it later if we want )
+  uint16_t duration = ultraEchoUs(0);
   if (duration == 0) {
     // no echo treat so just set to far 
     distance = 9999.0;
@@ -47,7 +47,12 @@ void loop() {
     distance = (duration * 0.0343f) / 2.0f; // cm (roughly need to actualy confirm that)
   }
 
-  Serial.print("Distance: "); Serial.println(distance);
+  // Print at ~10 Hz; 9600 baud can't keep up with every reading
+  static uint32_t lastPrint = 0;
+  if (millis() - lastPrint >= 100) {
+    lastPrint = millis();
+    Serial.print("Distance: "); Serial.println(distance);
+  }
   // Send once when we cross below 5 cm after >6 cm to re arm
   static bool armed = true;
   if (armed && distance > 0 && distance < 5.0) {
@@ -59,6 +64,4 @@ void loop() {
   } else if (!armed && distance > 6.0) {
     armed = true;  // re-arm when target moves away
   }
-
-  delay(100); // polls arround 10 Hz
 }